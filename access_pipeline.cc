@@ -0,0 +1,72 @@
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+#include "access_pipeline.hh"
+
+AccessPipeline::AccessPipeline(int tag_latency, int data_latency,
+                               bool parallel) :
+    accesses(0), stalls(0), maxInFlight(0),
+    latency(parallel ? std::max(tag_latency, data_latency)
+                     : tag_latency + data_latency),
+    busyUntil(-1), extendedTick(-1), extra(0), lastDue(0),
+    pendingWrites(0), retryScheduled(false)
+{
+    assert(tag_latency >= 0 && data_latency >= 0);
+}
+
+bool
+AccessPipeline::claim()
+{
+    if (curTick() <= busyUntil) {
+        stalls++;
+        if (!retryScheduled) {
+            retryScheduled = true;
+            schedule(busyUntil + 1 - curTick(),
+                     [this]{ retryScheduled = false; retry(); });
+        }
+        return false;
+    }
+    busyUntil = curTick();
+    accesses++;
+    return true;
+}
+
+void
+AccessPipeline::extend(int ticks)
+{
+    busyUntil = curTick() + ticks;
+    extendedTick = curTick();
+    extra = ticks;
+}
+
+void
+AccessPipeline::respond(int request_id, const uint8_t* data, int size)
+{
+    int64_t delay = latency + (extendedTick == curTick() ? extra : 0);
+    if (delay == 0 && responses.empty()) {
+        deliver(request_id, data);
+        return;
+    }
+
+    responses.push_back({request_id, data == nullptr, {}});
+    if (data) {
+        responses.back().data.assign(data, data + size);
+    } else {
+        pendingWrites++;
+    }
+    maxInFlight = std::max(maxInFlight, (int64_t)responses.size());
+    // Events of the same tick run in any order, but every response is due
+    // by the time any later one is, so each event sends the oldest.
+    lastDue = std::max(lastDue, curTick() + delay);
+    schedule(lastDue - curTick(), [this]{
+        Response response = std::move(responses.front());
+        responses.pop_front();
+        if (response.write) {
+            pendingWrites--;
+            deliver(response.requestId, nullptr);
+        } else {
+            deliver(response.requestId, response.data.data());
+        }
+    });
+}
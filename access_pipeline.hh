@@ -0,0 +1,100 @@
+#ifndef CSIM_ACCESS_PIPELINE_H
+#define CSIM_ACCESS_PIPELINE_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "ticked_object.hh"
+
+/**
+ * Times the tag lookup and data access of a cache.
+ *
+ * One new access can start each tick, later ones have to come back and the
+ * pipeline calls retry on the next tick. Every response leaves the pipeline
+ * the latency of an access after it was sent, in the order they were sent,
+ * so accesses overlap but are answered in order.
+ */
+class AccessPipeline : public TickedObject
+{
+  public:
+    /**
+     * @param tag_latency ticks to look up the tags
+     * @param data_latency ticks to read or write the data array
+     * @param parallel true if the tags and data are accessed at the same
+     *        time, false if the data array waits for the tag lookup
+     */
+    AccessPipeline(int tag_latency, int data_latency, bool parallel);
+
+    /**
+     * Called the tick after an access was turned away.
+     */
+    void setRetry(const std::function<void(void)>& retry) {
+        this->retry = retry;
+    }
+
+    /**
+     * Called when a response leaves the pipeline.
+     */
+    void setDeliver(
+            const std::function<void(int, const uint8_t*)>& deliver) {
+        this->deliver = deliver;
+    }
+
+    /**
+     * Start an access this tick.
+     *
+     * @return false if one has already started
+     */
+    bool claim();
+
+    /**
+     * The access started this tick takes ticks more. No access can start
+     * until they have passed, and responses sent this tick leave that much
+     * later. Responses never pass each other, so the ones after wait too.
+     */
+    void extend(int ticks);
+
+    /**
+     * Send a response after the access latency. size bytes of data are
+     * copied, nullptr for a write.
+     */
+    void respond(int request_id, const uint8_t* data, int size);
+
+    /**
+     * @return true if a write response is still in the pipeline. The write
+     *         has changed the cache, but the processor does not know yet.
+     */
+    bool writesInFlight() { return pendingWrites > 0; }
+
+    /// Ticks from the start of an access to its response
+    int getLatency() { return latency; }
+
+    int64_t accesses;
+    int64_t stalls; // accesses turned away because one had started
+    int64_t maxInFlight; // most responses in the pipeline at once
+
+  private:
+    struct Response {
+        int requestId;
+        bool write;
+        std::vector<uint8_t> data; // a copy, it may change in the cache
+    };
+
+    int latency;
+
+    /// Responses in the order they were sent
+    std::deque<Response> responses;
+
+    int64_t busyUntil; // last tick of the last access that started
+    int64_t extendedTick; // tick of the access that was extended
+    int extra; // ticks that access was extended by
+    int64_t lastDue; // tick the newest response leaves
+    int64_t pendingWrites;
+    std::function<void(void)> retry;
+    std::function<void(int, const uint8_t*)> deliver;
+    bool retryScheduled;
+};
+
+#endif // CSIM_ACCESS_PIPELINE_H
@@ -0,0 +1,170 @@
+#include <cstring>
+
+#include "backing_store.hh"
+#include "util.hh"
+
+/// Pages are 4 KB unless a single line is larger than that.
+static const int minPageBits = 12;
+
+/// Each region has a table of 512 pages (2 MB with 4 KB pages).
+static const int tableBits = 9;
+
+/// Number of pages carved out of each arena chunk.
+static const int pagesPerChunk = 16;
+
+/// Starting number of directory slots. Always a power of two.
+static const int initialDirectory = 64;
+
+BackingStore::BackingStore(int addr_bits, int line_size, uint8_t fill_value) :
+    addrBits(addr_bits),
+    lineBits(log2int(line_size)),
+    pageBits(lineBits > minPageBits ? lineBits : minPageBits),
+    fillValue(fill_value),
+    regions(0), lastRegion({0, nullptr}),
+    chunkFree(0), pages(0)
+{
+    assert(addrBits <= 64);
+    assert(addrBits >= lineBits);
+
+    int lines_per_page = 1 << (pageBits - lineBits);
+    dirtyWords = (lines_per_page + 63) / 64;
+    pageBytes = (1 << pageBits) + dirtyWords * sizeof(uint64_t);
+
+    directory.resize(initialDirectory, {0, nullptr});
+}
+
+BackingStore::~BackingStore()
+{
+    for (auto &region : directory) {
+        delete[] region.table;
+    }
+    for (auto chunk : chunks) {
+        delete[] chunk;
+    }
+}
+
+uint8_t*
+BackingStore::getLine(uint64_t line_address)
+{
+    uint8_t *page = findPage(line_address, true);
+    return page + (line_address & ((1 << pageBits) - 1));
+}
+
+uint8_t*
+BackingStore::findLine(uint64_t line_address)
+{
+    uint8_t *page = findPage(line_address, false);
+    if (!page) return nullptr;
+    return page + (line_address & ((1 << pageBits) - 1));
+}
+
+void
+BackingStore::setDirty(uint64_t line_address, bool dirty)
+{
+    uint8_t *page = findPage(line_address, false);
+    assert(page);
+    int line = (line_address & ((1 << pageBits) - 1)) >> lineBits;
+    uint64_t bit = (uint64_t)1 << (line & 63);
+    if (dirty) {
+        dirtyBits(page)[line / 64] |= bit;
+    } else {
+        dirtyBits(page)[line / 64] &= ~bit;
+    }
+}
+
+bool
+BackingStore::isDirty(uint64_t line_address)
+{
+    uint8_t *page = findPage(line_address, false);
+    if (!page) return false;
+    int line = (line_address & ((1 << pageBits) - 1)) >> lineBits;
+    return (dirtyBits(page)[line / 64] >> (line & 63)) & 1;
+}
+
+int64_t
+BackingStore::getHostBytes()
+{
+    int64_t bytes = directory.size() * sizeof(Region);
+    bytes += regions * (1 << tableBits) * sizeof(uint8_t*);
+    bytes += chunks.size() * pagesPerChunk * pageBytes;
+    return bytes;
+}
+
+uint8_t*
+BackingStore::findPage(uint64_t line_address, bool allocate)
+{
+    assert(fitsInBits(line_address, addrBits));
+    uint64_t page_number = line_address >> pageBits;
+
+    uint8_t **table = findRegion(page_number >> tableBits, allocate);
+    if (!table) return nullptr;
+
+    uint8_t *&page = table[page_number & ((1 << tableBits) - 1)];
+    if (!page && allocate) {
+        page = allocatePage();
+    }
+    return page;
+}
+
+uint8_t**
+BackingStore::findRegion(uint64_t region, bool allocate)
+{
+    uint64_t key = region + 1;
+    if (lastRegion.key == key) return lastRegion.table;
+
+    uint64_t mask = directory.size() - 1;
+    uint64_t slot = hashIndex(key) & mask;
+    while (directory[slot].key != key) {
+        if (directory[slot].key == 0) {
+            if (!allocate) return nullptr;
+            if ((regions + 1) * 2 > (int64_t)directory.size()) {
+                // Keep the directory at most half full.
+                growDirectory();
+                return findRegion(region, allocate);
+            }
+            directory[slot].key = key;
+            directory[slot].table = new uint8_t*[1 << tableBits]();
+            regions++;
+            break;
+        }
+        slot = (slot + 1) & mask;
+    }
+
+    lastRegion = directory[slot];
+    return lastRegion.table;
+}
+
+void
+BackingStore::growDirectory()
+{
+    std::vector<Region> old(directory.size() * 2, {0, nullptr});
+    old.swap(directory);
+
+    uint64_t mask = directory.size() - 1;
+    for (auto &region : old) {
+        if (!region.key) continue;
+        uint64_t slot = hashIndex(region.key) & mask;
+        while (directory[slot].key) {
+            slot = (slot + 1) & mask;
+        }
+        directory[slot] = region;
+    }
+}
+
+uint8_t*
+BackingStore::allocatePage()
+{
+    if (chunkFree == 0) {
+        chunks.push_back(
+            new uint64_t[pagesPerChunk * pageBytes / sizeof(uint64_t)]);
+        chunkFree = pagesPerChunk;
+    }
+    uint8_t *chunk = reinterpret_cast<uint8_t*>(chunks.back());
+    uint8_t *page = chunk + (pagesPerChunk - chunkFree) * pageBytes;
+    chunkFree--;
+    pages++;
+
+    memset(page, fillValue, 1 << pageBits);
+    memset(dirtyBits(page), 0, dirtyWords * sizeof(uint64_t));
+    return page;
+}
@@ -0,0 +1,128 @@
+#ifndef CSIM_BACKING_STORE_H
+#define CSIM_BACKING_STORE_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Flat storage for the contents of memory.
+ *
+ * The address space is split into pages of lines. Pages are found through a
+ * two-level page table and are only allocated the first time one of their
+ * lines is touched. Page memory comes from a simple arena so that allocation
+ * is cheap and teardown only frees a handful of chunks.
+ *
+ * The first level of the table is a hash table of regions, so the store
+ * stays small even when a 48 or 64-bit address space is touched in a few
+ * scattered places. Each region has a flat table of its pages.
+ */
+class BackingStore
+{
+  public:
+    /**
+     * @param addr_bits is the number of bits in an address (up to 64)
+     * @param line_size in bytes. Must be a power of two.
+     * @param fill_value is the value of every byte of a newly touched page
+     */
+    BackingStore(int addr_bits, int line_size, uint8_t fill_value);
+    ~BackingStore();
+
+    /**
+     * @return a pointer to the data for the line. Allocates the page that
+     *         holds the line if it has not been touched yet.
+     *         NOTE: This pointer stays valid until the store is destroyed.
+     */
+    uint8_t* getLine(uint64_t line_address);
+
+    /**
+     * @return a pointer to the data for the line or nullptr if the page that
+     *         holds the line has never been touched.
+     */
+    uint8_t* findLine(uint64_t line_address);
+
+    /**
+     * Sets the dirty bit of the line. The line's page must exist.
+     */
+    void setDirty(uint64_t line_address, bool dirty);
+
+    /**
+     * @return true if the line's dirty bit is set
+     */
+    bool isDirty(uint64_t line_address);
+
+    /**
+     * @return the number of pages that have been allocated
+     */
+    int64_t getPages() { return pages; }
+
+    /**
+     * @return the number of bytes of host memory used for pages and tables
+     */
+    int64_t getHostBytes();
+
+  private:
+    int addrBits;
+    int lineBits;
+    int pageBits;
+    uint8_t fillValue;
+
+    /// Bytes of data plus dirty bits for a single page
+    int64_t pageBytes;
+
+    /// Number of 64-bit words of dirty bits at the end of each page
+    int dirtyWords;
+
+    struct Region {
+        uint64_t key; // region number + 1, 0 if the slot is empty
+        uint8_t **table; // pointers to the region's pages
+    };
+
+    /// First level of the page table. Open addressing with linear probing.
+    std::vector<Region> directory;
+
+    /// Number of regions in the directory
+    int64_t regions;
+
+    /// Last region looked up, most lookups hit it again
+    Region lastRegion;
+
+    /// Chunks of page memory handed out by allocatePage
+    std::vector<uint64_t*> chunks;
+
+    /// Number of pages that are still free in the last chunk
+    int chunkFree;
+
+    int64_t pages;
+
+    /**
+     * @return the page holding the line, or nullptr. If allocate is true a
+     *         missing page is created.
+     */
+    uint8_t* findPage(uint64_t line_address, bool allocate);
+
+    /**
+     * @return the page table of the region, or nullptr. If allocate is true
+     *         a missing region is created.
+     */
+    uint8_t** findRegion(uint64_t region, bool allocate);
+
+    /**
+     * Doubles the size of the directory.
+     */
+    void growDirectory();
+
+    /**
+     * @return a new page from the arena with its data set to fillValue and
+     *         all dirty bits cleared.
+     */
+    uint8_t* allocatePage();
+
+    /**
+     * @return the dirty bit words for the page
+     */
+    uint64_t* dirtyBits(uint8_t *page) {
+        return reinterpret_cast<uint64_t*>(page + (1 << pageBits));
+    }
+};
+
+#endif // CSIM_BACKING_STORE_H
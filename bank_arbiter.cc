@@ -0,0 +1,55 @@
+#include <cassert>
+
+#include "bank_arbiter.hh"
+
+BankArbiter::BankArbiter(int banks, int ports, int select_bit) :
+    banks(banks, {-1, 0, 0, 0}), ports(ports), selectBit(select_bit),
+    retryScheduled(false)
+{
+    assert(banks > 0 && (banks & (banks - 1)) == 0);
+    assert(ports > 0);
+    assert(select_bit >= 0 && select_bit < 64);
+}
+
+BankArbiter::Bank&
+BankArbiter::bankOf(uint64_t address)
+{
+    Bank &bank = banks[(address >> selectBit) & (banks.size() - 1)];
+    if (bank.lastTick != curTick()) {
+        bank.lastTick = curTick();
+        bank.used = 0;
+    }
+    return bank;
+}
+
+bool
+BankArbiter::claim(uint64_t address)
+{
+    Bank &bank = bankOf(address);
+    if (bank.used >= ports) {
+        bank.conflicts++;
+        if (!retryScheduled) {
+            retryScheduled = true;
+            schedule(1, [this]{ retryScheduled = false; retry(); });
+        }
+        return false;
+    }
+    bank.used++;
+    bank.accesses++;
+    return true;
+}
+
+void
+BankArbiter::force(uint64_t address)
+{
+    Bank &bank = bankOf(address);
+    bank.used++;
+    bank.accesses++;
+}
+
+double
+BankArbiter::getUtilization(int bank)
+{
+    int64_t ticks = curTick() + 1;
+    return (double)banks[bank].accesses / ((double)ticks * ports);
+}
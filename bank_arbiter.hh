@@ -0,0 +1,75 @@
+#ifndef CSIM_BANK_ARBITER_H
+#define CSIM_BANK_ARBITER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "ticked_object.hh"
+
+/**
+ * Decides which accesses get a port of a banked data array each tick.
+ *
+ * The array is split into banks by a few address bits and each bank has a
+ * number of ports. An access that finds every port of its bank taken this
+ * tick is a conflict and has to come back; the arbiter calls retry on the
+ * next tick.
+ */
+class BankArbiter : public TickedObject
+{
+  public:
+    /**
+     * @param banks a power of two
+     * @param ports of each bank, accesses it can take per tick
+     * @param select_bit the lowest address bit that picks the bank
+     */
+    BankArbiter(int banks, int ports, int select_bit);
+
+    /**
+     * Called the tick after a conflict.
+     */
+    void setRetry(const std::function<void(void)>& retry) {
+        this->retry = retry;
+    }
+
+    /**
+     * Take a port of the bank of address for this tick.
+     *
+     * @return false if all of its ports are taken
+     */
+    bool claim(uint64_t address);
+
+    /**
+     * Take a port even if all are taken, for fills that cannot wait.
+     */
+    void force(uint64_t address);
+
+    int getBanks() { return banks.size(); }
+    int getPorts() { return ports; }
+
+    struct Bank {
+        int64_t lastTick; // tick the ports were last used
+        int used; // ports used in lastTick
+        int64_t accesses;
+        int64_t conflicts;
+    };
+
+    const Bank& getBank(int bank) { return banks[bank]; }
+
+    /**
+     * @return the fraction of the port ticks so far that bank used
+     */
+    double getUtilization(int bank);
+
+  private:
+    /// @return the bank of address with its port count for this tick
+    Bank& bankOf(uint64_t address);
+
+    std::vector<Bank> banks;
+    int ports;
+    int selectBit;
+    std::function<void(void)> retry;
+    bool retryScheduled;
+};
+
+#endif // CSIM_BANK_ARBITER_H
@@ -0,0 +1,191 @@
+#include <cassert>
+#include <cstring>
+
+#include "bdi.hh"
+#include "util.hh"
+
+namespace {
+
+uint64_t
+load(const uint8_t* data, int bytes)
+{
+    uint64_t value = 0;
+    memcpy(&value, data, bytes);
+    return value;
+}
+
+void
+store(uint8_t* data, int bytes, uint64_t value)
+{
+    memcpy(data, &value, bytes);
+}
+
+/// @return value of bits bits as a signed number
+int64_t
+signExtend(uint64_t value, int bits)
+{
+    if (bits == 64) return (int64_t)value;
+    uint64_t sign = (uint64_t)1 << (bits - 1);
+    value &= bitMask(bits);
+    return (int64_t)((value ^ sign) - sign);
+}
+
+/// @return true if delta fits in a signed number of bytes bytes
+bool
+fitsDelta(int64_t delta, int bytes)
+{
+    int64_t limit = (int64_t)1 << (bytes * 8 - 1);
+    return delta >= -limit && delta < limit;
+}
+
+} // anonymous namespace
+
+BDICompressor::BDICompressor(int line_size) :
+    lineSize(line_size)
+{
+    assert(line_size > 0);
+    sizes[Raw] = line_size;
+    sizes[Zeros] = 1;
+    sizes[Repeated] = line_size % 8 == 0 && line_size > 8 ? 8 : 0;
+    for (int encoding = Base8Delta1; encoding < NumEncodings; encoding++) {
+        int base = baseBytes(encoding);
+        int elements = line_size / base;
+        sizes[encoding] = 0;
+        if (line_size % base != 0) continue;
+        // base, one bit per element to pick the base, then the deltas
+        int size = base + (elements + 7) / 8 + elements * deltaBytes(encoding);
+        if (size < line_size) sizes[encoding] = size;
+    }
+}
+
+int
+BDICompressor::compress(const uint8_t* line, uint8_t* out)
+{
+    bool zeros = true;
+    for (int i = 0; i < lineSize; i++) {
+        if (line[i]) {
+            zeros = false;
+            break;
+        }
+    }
+    if (zeros) {
+        out[0] = 0;
+        return Zeros;
+    }
+
+    if (sizes[Repeated]) {
+        bool repeated = true;
+        for (int i = 8; i < lineSize; i += 8) {
+            if (memcmp(line, &line[i], 8) != 0) {
+                repeated = false;
+                break;
+            }
+        }
+        if (repeated) {
+            memcpy(out, line, 8);
+            return Repeated;
+        }
+    }
+
+    int best = Raw;
+    for (int encoding = Base8Delta1; encoding < NumEncodings; encoding++) {
+        if (!sizes[encoding] || sizes[encoding] >= sizes[best]) continue;
+        if (encode(line, baseBytes(encoding), deltaBytes(encoding), out)) {
+            best = encoding;
+        }
+    }
+    // Encode again, a later try that failed may have written over out.
+    if (best == Raw) {
+        memcpy(out, line, lineSize);
+    } else {
+        encode(line, baseBytes(best), deltaBytes(best), out);
+    }
+    return best;
+}
+
+bool
+BDICompressor::encode(const uint8_t* line, int base, int delta, uint8_t* out)
+{
+    int elements = lineSize / base;
+    int bits = base * 8;
+    uint8_t* mask = &out[base];
+    uint8_t* deltas = &mask[(elements + 7) / 8];
+    bool have_base = false;
+    uint64_t base_value = 0;
+
+    memset(mask, 0, (elements + 7) / 8);
+    for (int i = 0; i < elements; i++) {
+        uint64_t value = load(&line[i * base], base);
+        int64_t diff = signExtend(value, bits);
+        if (!fitsDelta(diff, delta)) {
+            // The first element far from zero is the base.
+            if (!have_base) {
+                base_value = value;
+                have_base = true;
+            }
+            diff = signExtend(value - base_value, bits);
+            if (!fitsDelta(diff, delta)) return false;
+            mask[i / 8] |= 1 << (i % 8);
+        }
+        store(&deltas[i * delta], delta, (uint64_t)diff);
+    }
+    store(out, base, base_value);
+    return true;
+}
+
+void
+BDICompressor::decompress(int encoding, const uint8_t* in, uint8_t* out)
+{
+    switch (encoding) {
+      case Raw:
+        memcpy(out, in, lineSize);
+        return;
+      case Zeros:
+        memset(out, 0, lineSize);
+        return;
+      case Repeated:
+        for (int i = 0; i < lineSize; i += 8) {
+            memcpy(&out[i], in, 8);
+        }
+        return;
+    }
+
+    int base = baseBytes(encoding);
+    int delta = deltaBytes(encoding);
+    int elements = lineSize / base;
+    uint64_t base_value = load(in, base);
+    const uint8_t* mask = &in[base];
+    const uint8_t* deltas = &mask[(elements + 7) / 8];
+    for (int i = 0; i < elements; i++) {
+        uint64_t value = signExtend(load(&deltas[i * delta], delta),
+                                    delta * 8);
+        if (mask[i / 8] & (1 << (i % 8))) {
+            value += base_value;
+        }
+        store(&out[i * base], base, value);
+    }
+}
+
+int
+BDICompressor::baseBytes(int encoding)
+{
+    switch (encoding) {
+      case Base8Delta1: case Base8Delta2: case Base8Delta4: return 8;
+      case Base4Delta1: case Base4Delta2: return 4;
+      case Base2Delta1: return 2;
+    }
+    assert(0);
+    return 0;
+}
+
+int
+BDICompressor::deltaBytes(int encoding)
+{
+    switch (encoding) {
+      case Base8Delta1: case Base4Delta1: case Base2Delta1: return 1;
+      case Base8Delta2: case Base4Delta2: return 2;
+      case Base8Delta4: return 4;
+    }
+    assert(0);
+    return 0;
+}
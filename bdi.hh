@@ -0,0 +1,69 @@
+#ifndef CSIM_BDI_H
+#define CSIM_BDI_H
+
+#include <cstdint>
+
+/**
+ * Base-delta-immediate compression of a line.
+ *
+ * The line is split into elements of 2, 4 or 8 bytes. Each element is
+ * stored as a small signed delta from either zero or one base taken from
+ * the line, with one bit per element saying which. Lines of zeros and lines
+ * of one repeated 8 byte value have their own encodings. The smallest
+ * encoding that fits is used, or the line is stored as it is.
+ */
+class BDICompressor
+{
+  public:
+    enum Encoding {
+        Raw,
+        Zeros,
+        Repeated,
+        Base8Delta1,
+        Base8Delta2,
+        Base8Delta4,
+        Base4Delta1,
+        Base4Delta2,
+        Base2Delta1,
+        NumEncodings
+    };
+
+    BDICompressor(int line_size);
+
+    /**
+     * Compress line into out, which must have space for a whole line.
+     *
+     * @return the encoding used. getSize(encoding) bytes of out are written.
+     */
+    int compress(const uint8_t* line, uint8_t* out);
+
+    /**
+     * Expand getSize(encoding) bytes of in back into a line in out.
+     */
+    void decompress(int encoding, const uint8_t* in, uint8_t* out);
+
+    /**
+     * @return the bytes a line compressed with encoding takes
+     */
+    int getSize(int encoding) { return sizes[encoding]; }
+
+  private:
+    /// @return the base and delta size of a base-delta encoding
+    static int baseBytes(int encoding);
+    static int deltaBytes(int encoding);
+
+    /**
+     * Try to encode line with elements of base bytes and deltas of delta
+     * bytes.
+     *
+     * @return false if an element is too far from both zero and the base
+     */
+    bool encode(const uint8_t* line, int base, int delta, uint8_t* out);
+
+    int lineSize;
+
+    /// Compressed size of each encoding, 0 if it cannot be used
+    int sizes[NumEncodings];
+};
+
+#endif // CSIM_BDI_H
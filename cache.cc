@@ -1,26 +1,356 @@
 
 #include <cassert>
+#include <cstring>
+#include <iostream>
 
 #include "cache.hh"
-#include "memory.hh"
 #include "processor.hh"
+#include "util.hh"
 
-Cache::Cache(int64_t size, Memory& memory, Processor& processor) :
-size(size), memory(memory), processor(processor)
+Cache::Cache(int64_t size, ResponsePort& memory, Processor& processor) :
+size(size), memory(memory), processor(processor),
+lineSize(memory.getLineSize()), lineBits(memory.getLineBits()),
+addrBits(processor.getAddrSize()), upper(&processor),
+inclusion(NonInclusive), writePolicy(WriteBack), writeQueue(nullptr),
+writebackBuffer(nullptr), banks(nullptr), pipeline(nullptr), name("Cache"),
+retryNeeded(false),
+hits(0), misses(0), writebacks(0), lineWrites(0), partialWrites(0),
+writebackStalls(0)
 {
-  memory.setCache(this);
+  memory.setRequestor(this);
   processor.setCache(this);
 }
 
+Cache::~Cache()
+{
+    std::cout << name << " hits: " << hits << " misses: " << misses;
+    std::cout << " writebacks: " << writebacks << std::endl;
+    if (writeQueue) {
+        std::cout << name << " buffered writes: " << writeQueue->writes;
+        std::cout << " combined: " << writeQueue->combined;
+        std::cout << " line writes: " << lineWrites;
+        std::cout << " partial writes: " << partialWrites << std::endl;
+    }
+    if (writebackBuffer) {
+        std::cout << name << " writeback buffer parked: ";
+        std::cout << writebackBuffer->parked;
+        std::cout << " hits: " << writebackBuffer->hits;
+        std::cout << " max occupancy: " << writebackBuffer->maxOccupancy;
+        std::cout << " full stalls: " << writebackStalls << std::endl;
+    }
+    if (banks) {
+        for (int bank = 0; bank < banks->getBanks(); bank++) {
+            std::cout << name << " bank " << bank << " accesses: ";
+            std::cout << banks->getBank(bank).accesses;
+            std::cout << " conflicts: " << banks->getBank(bank).conflicts;
+            std::cout << " utilization: ";
+            std::cout << 100 * banks->getUtilization(bank) << "%";
+            std::cout << std::endl;
+        }
+    }
+    if (pipeline) {
+        std::cout << name << " access latency: " << pipeline->getLatency();
+        std::cout << " accesses: " << pipeline->accesses;
+        std::cout << " stalls: " << pipeline->stalls;
+        std::cout << " max in flight: " << pipeline->maxInFlight;
+        std::cout << std::endl;
+    }
+    delete writeQueue;
+    delete writebackBuffer;
+    delete banks;
+    delete pipeline;
+}
+
+void
+Cache::setInclusion(Inclusion inclusion)
+{
+    assert(inclusion == NonInclusive);
+    this->inclusion = inclusion;
+}
+
+void
+Cache::setWritePolicy(WritePolicy policy, int entries)
+{
+    assert(!writeQueue || writeQueue->isEmpty());
+    writePolicy = policy;
+    delete writeQueue;
+    writeQueue = nullptr;
+    if (policy != WriteBack) {
+        writeQueue = new WriteBuffer(entries, getLineSize(),
+                                     policy == WriteCombining);
+    }
+}
+
+void
+Cache::setWritebackBuffer(int entries)
+{
+    assert(!writebackBuffer || writebackBuffer->getSize() == 0);
+    delete writebackBuffer;
+    writebackBuffer = nullptr;
+    if (entries <= 0) return;
+
+    writebackBuffer = new WritebackBuffer(entries, getLineSize());
+    writebackBuffer->setSend([this](uint64_t address, const uint8_t* data) {
+        // No response for writes, no need for valid request_id
+        return memory.receiveRequest(address, getLineSize(), data, -1);
+    });
+    // A request may have been rejected for want of space.
+    writebackBuffer->setFreed([this]{ sendRetry(); });
+}
+
 void
-Cache::sendResponse(int request_id, const uint8_t* data)
+Cache::setBanks(int banks, int ports, int select_bit)
+{
+    delete this->banks;
+    this->banks = nullptr;
+    if (banks <= 0) return;
+
+    if (select_bit < 0) {
+        select_bit = lineBits;
+    }
+    this->banks = new BankArbiter(banks, ports, select_bit);
+    // The request that conflicted can go now.
+    this->banks->setRetry([this]{ sendRetry(); });
+}
+
+void
+Cache::setHitLatency(int tag_latency, int data_latency, bool parallel)
+{
+    delete pipeline;
+    pipeline = new AccessPipeline(tag_latency, data_latency, parallel);
+    pipeline->setDeliver([this](int request_id, const uint8_t* data) {
+        upper->receiveResponse(request_id, data);
+    });
+    // The request that was turned away can go now.
+    pipeline->setRetry([this]{ sendRetry(); });
+}
+
+bool
+Cache::writebacksAreCurrent()
+{
+    // A write the processor has not seen the response of is only in the
+    // caches.
+    if (writesInFlight()) return false;
+
+    // Nothing above the top level cache can hold data.
+    if (upper->needsWriteResponse()) return true;
+
+    switch (inclusion) {
+      case Inclusive:
+        // Evictions collect the newest data from above, but a parked line
+        // misses writes the level above buffers after it was parked.
+        return !writebackBuffer || !upper->leavesStaleCopies();
+      case Exclusive:
+        // Lines only come from above, but an exclusive level above writes
+        // back the lines it moves up.
+        return upper->writebacksAreCurrent() && !upper->leavesStaleCopies();
+      default:
+        // The level above may have a newer dirty copy.
+        return false;
+    }
+}
+
+void
+Cache::sendResponse(int request_id, const uint8_t* data, int size)
+{
+    if (!data && !upper->needsWriteResponse()) return;
+    if (pipeline) {
+        pipeline->respond(request_id, data, size);
+        return;
+    }
+    upper->receiveResponse(request_id, data);
+}
+
+bool
+Cache::receiveInvalidate(uint64_t address, uint8_t* data)
+{
+    bool was_dirty = upper->receiveInvalidate(address, data);
+    if (!was_dirty && writeQueue && writeQueue->merge(address, data)) {
+        was_dirty = true;
+    }
+
+    int parked = writebackBuffer ? writebackBuffer->find(address) : -1;
+    if (parked >= 0) {
+        // A parked line is not in the arrays.
+        if (!was_dirty) {
+            memcpy(data, writebackBuffer->getLine(parked), lineSize);
+            was_dirty = true;
+        }
+        writebackBuffer->remove(parked);
+        return was_dirty;
+    }
+
+    return invalidateLine(address, data, was_dirty);
+}
+
+bool
+Cache::startRequest(uint64_t address, int size, bool blocked)
+{
+    assert(size <= lineSize); // within line size
+    // within address range
+    assert(fitsInBits(address, addrBits));
+    assert((address & (size - 1)) == 0); // naturally aligned
+
+    if (blocked) {
+        DPRINT("Cache is blocked!");
+        // Cache is currently blocked, so it cannot receive a new request
+        return rejectRequest();
+    }
+    if (!claimPipeline()) {
+        DPRINT("Pipeline busy!");
+        return rejectRequest();
+    }
+    if (!claimBank(address)) {
+        DPRINT("Bank conflict!");
+        return rejectRequest();
+    }
+    return true;
+}
+
+bool
+Cache::writeThroughHit(uint64_t address, int size, const uint8_t* data)
+{
+    if (data && writePolicy == WriteThrough &&
+        !bufferWrite(address, size, data)) {
+        return rejectRequest();
+    }
+    return true;
+}
+
+bool
+Cache::writeAround(uint64_t address, int size, const uint8_t* data,
+                   int request_id)
 {
-    processor.receiveResponse(request_id, data);
+    if (!bufferWrite(address, size, data)) {
+        return rejectRequest();
+    }
+    misses++;
+    sendResponse(request_id, nullptr);
+    drainWrites();
+    return true;
 }
 
 void
+Cache::sendRetry()
+{
+    if (retryNeeded) {
+        retryNeeded = false;
+        upper->receiveRetry();
+    }
+}
+
+bool
+Cache::rejectRequest()
+{
+    retryNeeded = true;
+    return false;
+}
+
+bool
 Cache::sendMemRequest(uint64_t address, int size, const uint8_t* data,
                       int request_id)
 {
-    memory.receiveRequest(address, size, data, request_id);
+    // Parked writebacks wait for a tick the port is not used.
+    if (writebackBuffer) writebackBuffer->portBusy();
+    return memory.receiveRequest(address, size, data, request_id);
+}
+
+bool
+Cache::sendFillRequest(uint64_t address, int request_id)
+{
+    if (writebackBuffer) writebackBuffer->portBusy();
+    return memory.receiveFillRequest(address, request_id);
+}
+
+void
+Cache::sendEviction(uint64_t address, const uint8_t* data)
+{
+    if (memory.wantsCleanEvictions()) {
+        memory.receiveEviction(address, data);
+    }
+}
+
+bool
+Cache::bufferWrite(uint64_t address, int size, const uint8_t* data)
+{
+    uint64_t line_address = address & ~(uint64_t)(getLineSize() - 1);
+    if (writeQueue->isCombining() && writeQueue->isFull() &&
+        writeQueue->find(line_address) < 0) {
+        // Make room by sending the oldest line as it is.
+        if (!sendBufferedWrite(writeQueue->get(0))) return false;
+        writeQueue->remove(0);
+    }
+    return writeQueue->add(address, size, data);
+}
+
+void
+Cache::drainWrites()
+{
+    if (!writeQueue) return;
+
+    // A combining buffer keeps partial lines so later stores can fill them.
+    for (int i = 0; i < writeQueue->getSize();) {
+        WriteBuffer::Entry &entry = writeQueue->get(i);
+        if (writeQueue->isCombining() && !writeQueue->isComplete(entry)) {
+            i++;
+            continue;
+        }
+        if (!sendBufferedWrite(entry)) return;
+        writeQueue->remove(i);
+    }
+}
+
+bool
+Cache::flushWrites(uint64_t line_address)
+{
+    if (!writeQueue) return true;
+
+    int position = writeQueue->find(line_address);
+    if (position < 0) return true;
+    if (!sendBufferedWrite(writeQueue->get(position))) return false;
+    writeQueue->remove(position);
+    return true;
+}
+
+bool
+Cache::sendBufferedWrite(WriteBuffer::Entry &entry)
+{
+    int line_size = getLineSize();
+    for (int offset = 0; offset < line_size;) {
+        if (!entry.valid[offset]) {
+            offset++;
+            continue;
+        }
+        // The largest aligned piece starting here that is all written
+        int size = offset ? (offset & -offset) : line_size;
+        for (int i = offset; i < offset + size;) {
+            if (entry.valid[i]) {
+                i++;
+            } else {
+                size /= 2;
+                i = offset;
+            }
+        }
+
+        // No response for writes, no need for valid request_id
+        if (!sendMemRequest(entry.lineAddress + offset, size,
+                            &entry.data[offset], -1)) {
+            return false;
+        }
+        if (size == line_size) lineWrites++; else partialWrites++;
+        for (int i = offset; i < offset + size; i++) {
+            entry.valid[i] = false;
+        }
+        entry.validBytes -= size;
+        offset += size;
+    }
+    return true;
+}
+
+void
+Cache::receiveMemRetry()
+{
+    if (writebackBuffer) writebackBuffer->retry();
+    drainWrites();
+    sendRetry();
 }
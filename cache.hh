@@ -1,26 +1,64 @@
-
 #ifndef CSIM_CACHE_H
 #define CSIM_CACHE_H
 
 #include <cstdint>
+#include <string>
+
+#include "access_pipeline.hh"
+#include "bank_arbiter.hh"
+#include "port.hh"
+#include "write_buffer.hh"
+#include "writeback_buffer.hh"
 
-class Memory;
 class Processor;
 
-class Cache
+/**
+ * Base class of all caches.
+ *
+ * A cache receives requests from the level above (the processor or another
+ * cache) and sends line sized requests to the level below (memory or another
+ * cache). Caches are built from the bottom up: each new cache connects
+ * itself above the level it is given, and the processor always sends its
+ * requests to the last cache that was built.
+ */
+class Cache : public ResponsePort, public RequestPort
 {
   public:
+    /**
+     * How the contents of this cache relate to the levels above it.
+     */
+    enum Inclusion {
+        NonInclusive, // no relation
+        Inclusive,    // everything above is also in this cache
+        Exclusive     // nothing above is also in this cache
+    };
+
+    /**
+     * What this cache does with writes.
+     */
+    enum WritePolicy {
+        WriteBack,       // write misses fetch the line, dirty lines go down
+                         // when they are evicted
+        WriteThrough,    // every write also goes down, write misses do not
+                         // fetch the line
+        NoWriteAllocate, // write back, but write misses go down without
+                         // fetching the line
+        WriteCombining   // like NoWriteAllocate, and write misses to the
+                         // same line are merged into one write
+    };
+
     /**
      * @param size is the *total* size of the cache in bytes
-     * @param the memory that is below this cache
-     * @param processor this cache is connected tos
+     * @param memory is the level below this cache, memory or another cache
+     * @param processor this cache is connected to
      */
-    Cache(int64_t size, Memory& memory, Processor& processor);
+    Cache(int64_t size, ResponsePort& memory, Processor& processor);
 
     /**
-     * Virtual destructor. Please override in sub classes
+     * Virtual destructor. Please override in sub classes.
+     * Prints the statistics of this cache.
      */
-    virtual ~Cache() { }
+    virtual ~Cache();
 
     /**
      * Called when the processors sends load or store request.
@@ -38,7 +76,7 @@ class Cache
      *         blocked and the request must be retried later.
      */
     virtual bool receiveRequest(uint64_t address, int size, const uint8_t* data,
-                                int request_id) = 0;
+                                int request_id) override = 0;
 
     /**
      * Called when memory id finished processing a request.
@@ -50,39 +88,299 @@ class Cache
      */
     virtual void receiveMemResponse(int request_id, const uint8_t* data) = 0;
 
+    /**
+     * Called when memory has space again after rejecting a request.
+     * By default this passes the retry on to the processor.
+     */
+    virtual void receiveMemRetry();
+
+    /**
+     * Sets how this cache treats the levels above it.
+     * Only NonBlockingCache supports Inclusive and Exclusive.
+     */
+    virtual void setInclusion(Inclusion inclusion);
+
+    /**
+     * Sets the write policy. The default is WriteBack. The others send
+     * writes down through a write buffer of entries lines.
+     */
+    void setWritePolicy(WritePolicy policy, int entries = 8);
+
+    /**
+     * Park dirty evictions in a writeback buffer of entries lines, which
+     * drains when the port to the level below is idle. A request for a
+     * parked line takes it back, and a full buffer stalls new fills.
+     * Without one, evictions are written back right away.
+     */
+    void setWritebackBuffer(int entries);
+
+    /**
+     * Split the data array into banks, each with ports accesses per tick.
+     * A request to a bank whose ports are all taken this tick is rejected
+     * and retried the next tick. Fills take a port first.
+     *
+     * @param select_bit the lowest address bit that picks the bank, -1 for
+     *        the line offset bits, so consecutive lines are in different
+     *        banks
+     */
+    void setBanks(int banks, int ports = 1, int select_bit = -1);
+
+    /**
+     * Give accesses a latency instead of answering hits right away. One
+     * new access starts each tick and every response, hit or fill, leaves
+     * the latency of an access after it was sent.
+     *
+     * @param tag_latency ticks to look up the tags
+     * @param data_latency ticks to read or write the data array
+     * @param parallel true to access the tags and data at the same time,
+     *        false to access the data after the tag lookup
+     */
+    void setHitLatency(int tag_latency, int data_latency,
+                       bool parallel = false);
+
+    /**
+     * Sets the name used when printing statistics
+     */
+    void setName(const std::string &name) { this->name = name; }
+
+    /// Responses from the level below go to receiveMemResponse.
+    void receiveResponse(int request_id, const uint8_t* data) override {
+        receiveMemResponse(request_id, data);
+    }
+
+    /// Retries from the level below go to receiveMemRetry.
+    void receiveRetry() override { receiveMemRetry(); }
+
+    /// A cache only sends writebacks down, which need no response.
+    bool needsWriteResponse() override { return false; }
+
+    bool writebacksAreCurrent() override;
+
+    /// Writes still in the pipeline of this cache or one above
+    bool writesInFlight() override {
+        return (pipeline && pipeline->writesInFlight()) ||
+            upper->writesInFlight();
+    }
+
+    /// An exclusive cache writes back a dirty line when it moves up, and a
+    /// write buffer holds writes the levels below have not seen yet.
+    bool leavesStaleCopies() override {
+        return inclusion == Exclusive || writeQueue;
+    }
+
+    void setRequestor(RequestPort *requestor) override { upper = requestor; }
+
+    /**
+     * Called by an inclusive cache below when it evicts a line. The levels
+     * above have the newest data, then the write buffer, then the writeback
+     * buffer, then the arrays of this cache (invalidateLine).
+     */
+    bool receiveInvalidate(uint64_t address, uint8_t* data) override;
+
+    int getLineSize() override { return lineSize; }
+
+    int getLineBits() override { return lineBits; }
+
   protected:
     /**
-     * Send a response to the procesor.
+     * Remove the line of address from the tag and data arrays for
+     * receiveInvalidate, which has already taken it from the levels above
+     * and the buffers.
+     *
+     * @param was_dirty true if data already has a copy newer than below
+     * @return true if data has a copy newer than below
+     */
+    virtual bool invalidateLine(uint64_t address, uint8_t* data,
+                                bool was_dirty) = 0;
+
+    /**
+     * Check a request from the level above and claim the pipeline and the
+     * bank of address for it. Use as "if (!startRequest(...)) return
+     * false;" at the top of receiveRequest.
+     *
+     * @param blocked true if the cache cannot take any request now
+     * @return false if the request was rejected
+     */
+    bool startRequest(uint64_t address, int size, bool blocked);
+
+    /**
+     * A request hit. A store also goes to the write buffer if the write
+     * policy is WriteThrough.
+     *
+     * @return false if the request was rejected
+     */
+    bool writeThroughHit(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * A store missed and the write policy does not allocate. It goes down
+     * through the write buffer and is answered right away.
+     *
+     * @return false if the request was rejected
+     */
+    bool writeAround(uint64_t address, int size, const uint8_t* data,
+                     int request_id);
+
+    /**
+     * Send a response to the level above.
      *
      * @param request_id is the id that the processor used when it called
      *        receiveRequest
      * @param data is the data for the request. This data will only be read.
+     * @param size of the request, the bytes of data that are sent
+     */
+    void sendResponse(int request_id, const uint8_t* data, int size = 0);
+
+    /**
+     * Tell the level above it can retry, if this cache rejected a request.
+     */
+    void sendRetry();
+
+    /**
+     * Use as "return rejectRequest();" in receiveRequest to reject a
+     * request. sendRetry must be called once the cache can accept again.
+     *
+     * @return false
      */
-    void sendResponse(int request_id, const uint8_t* data);
+    bool rejectRequest();
 
     /**
      * Send a request to get data from main memory.
      *
      * @param address of the request
      * @param size of the request. NOTE: This must be the same as the memory
-     *        line size.
+     *        line size, except for writes from the write buffer.
      * @param when writing back to memory, data is a pointer to the data to
      *        write back. When reading it is nullptr.
      * @param request_id the id that must be used when replying to this request
      *        NOTE: You may choose any request id you want and the memory will
      *        use that id when it replies.
+     *
+     * @return true if memory accepted the request. If false, the request was
+     *         dropped and receiveMemRetry will be called later.
      */
-    void sendMemRequest(uint64_t address, int size, const uint8_t* data,
+    bool sendMemRequest(uint64_t address, int size, const uint8_t* data,
                         int request_id);
 
+    /**
+     * Read the line of address from below for a miss. If the level below
+     * sends lines in beats, the beat with address comes first.
+     *
+     * @return true if memory accepted the request, as sendMemRequest
+     */
+    bool sendFillRequest(uint64_t address, int request_id);
+
+    /**
+     * Tell the level below a clean line was evicted, if it wants to know.
+     */
+    void sendEviction(uint64_t address, const uint8_t* data);
+
+    /**
+     * Put a write that this cache does not keep in the write buffer. Call
+     * drainWrites after responding to it: the checker only knows the data
+     * of a store once it has been responded to.
+     *
+     * @return false if it has to wait, receiveMemRetry is called later
+     */
+    bool bufferWrite(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * Send the buffered writes that should not wait any longer.
+     */
+    void drainWrites();
+
+    /**
+     * Send the buffered writes to a line before reading it from below.
+     *
+     * @return false if memory is full and some are left
+     */
+    bool flushWrites(uint64_t line_address);
+
+    /**
+     * Take a port of the bank of address for a request. Always true if
+     * the data array is not banked.
+     */
+    bool claimBank(uint64_t address) {
+        return !banks || banks->claim(address);
+    }
+
+    /**
+     * Take a port of the bank of address for a fill.
+     */
+    void fillBank(uint64_t address) {
+        if (banks) banks->force(address);
+    }
+
+    /**
+     * Start an access in the pipeline this tick. Always true if accesses
+     * have no latency.
+     */
+    bool claimPipeline() {
+        return !pipeline || pipeline->claim();
+    }
+
+    /**
+     * The access this tick takes ticks more, if accesses have a latency.
+     */
+    void extendAccess(int ticks) {
+        if (pipeline) pipeline->extend(ticks);
+    }
+
     /// Size of cache in bytes
     int64_t size;
 
-    /// Memory below this cache
-    Memory &memory;
+    /// Memory or the cache below this cache
+    ResponsePort &memory;
 
     /// Processor that is sending this cache requests.
     Processor &processor;
+
+    /// The geometry of the levels around this cache, kept so lookups need
+    /// no calls. Line size and its log2 come from the level below.
+    int lineSize;
+    int lineBits;
+
+    /// Bits in an address of the processor
+    int addrBits;
+
+    /// The level above: the processor or the cache above this one.
+    RequestPort *upper;
+
+    Inclusion inclusion;
+
+    WritePolicy writePolicy;
+
+    /// Writes on their way down, nullptr for WriteBack
+    WriteBuffer *writeQueue;
+
+    /// Dirty evictions on their way down, may be nullptr
+    WritebackBuffer *writebackBuffer;
+
+    /// Ports of the data array banks, nullptr if it is not banked
+    BankArbiter *banks;
+
+    /// Times accesses, nullptr if hits are answered right away
+    AccessPipeline *pipeline;
+
+    std::string name;
+
+    /// True if a request was rejected and the level above needs a retry
+    bool retryNeeded;
+
+    int64_t hits;
+    int64_t misses;
+    int64_t writebacks;
+    int64_t lineWrites; // writes from the write buffer that were full lines
+    int64_t partialWrites;
+    int64_t writebackStalls; // requests rejected for a full writeback buffer
+
+  private:
+    /**
+     * Send the bytes of entry as few naturally aligned writes. The ones sent
+     * are removed from the entry.
+     *
+     * @return false if memory is full and some are left
+     */
+    bool sendBufferedWrite(WriteBuffer::Entry &entry);
 };
 
 #endif // CSIM_CACHE_H
@@ -0,0 +1,178 @@
+#ifndef CSIM_CACHE_GEOMETRY_H
+#define CSIM_CACHE_GEOMETRY_H
+
+#include <cassert>
+#include <cstdint>
+#include <utility>
+
+#include "replacement.hh"
+#include "set_index.hh"
+#include "tag_array.hh"
+
+/**
+ * The address math of a set associative cache: which set an address maps
+ * to, its tag and its offset in the line.
+ *
+ * A cache's request path is written once as a template over its geometry.
+ * CacheGeometry works for any cache and reads the numbers at run time,
+ * FixedGeometry is compiled for one line size, set count and way count.
+ */
+class CacheGeometry
+{
+  public:
+    CacheGeometry(const SetIndex &set_index, int line_size, int ways) :
+        setIndex(set_index), lineSize(line_size), ways(ways) { }
+
+    int64_t getSet(uint64_t address) const {
+        return setIndex.getSet(address);
+    }
+    uint64_t getTag(uint64_t address) const {
+        return setIndex.getTag(address);
+    }
+    int getOffset(uint64_t address) const {
+        return address & (lineSize - 1);
+    }
+    int getLineSize() const { return lineSize; }
+    int getWays() const { return ways; }
+
+    /// @return the way of set in tag_array that is valid and has tag, or -1
+    int findWay(TagArray &tag_array, int64_t set, uint64_t tag) const {
+        return tag_array.findWay(set, tag);
+    }
+
+  private:
+    const SetIndex &setIndex;
+    int lineSize;
+    int ways;
+};
+
+/**
+ * A geometry known when the simulator is compiled. Every shift, mask and
+ * multiply of the address math folds to a constant, and the tag compare
+ * loops over a fixed number of ways.
+ */
+template <int LineSize, int64_t Sets, int Ways>
+class FixedGeometry
+{
+  public:
+    static_assert(LineSize > 0 && (LineSize & (LineSize - 1)) == 0,
+                  "the line size must be a power of two");
+    static_assert(Sets > 0 && Ways > 0, "a cache needs sets and ways");
+
+    static int64_t getSet(uint64_t address) {
+        return address / LineSize % Sets;
+    }
+    static uint64_t getTag(uint64_t address) {
+        return address / LineSize / Sets;
+    }
+    static int getOffset(uint64_t address) { return address % LineSize; }
+    static int getLineSize() { return LineSize; }
+    static int64_t getSets() { return Sets; }
+    static int getWays() { return Ways; }
+
+    static int findWay(TagArray &tag_array, int64_t set, uint64_t tag) {
+        return tag_array.findWay<Ways>(set, tag);
+    }
+};
+
+/**
+ * A list of FixedGeometry. build calls builder.build<G>() with the first G
+ * that matches, so a factory can pick among the geometries compiled in.
+ * Builder::Result must be a pointer, nullptr means no geometry matched.
+ */
+template <class... Geometries>
+struct GeometryList;
+
+template <>
+struct GeometryList<>
+{
+    template <class Builder>
+    static typename Builder::Result
+    build(const Builder &builder, int line_size, int64_t sets, int ways)
+    {
+        return nullptr;
+    }
+};
+
+template <class G, class... Rest>
+struct GeometryList<G, Rest...>
+{
+    template <class Builder>
+    static typename Builder::Result
+    build(const Builder &builder, int line_size, int64_t sets, int ways)
+    {
+        if (G::getLineSize() == line_size && G::getSets() == sets &&
+            G::getWays() == ways) {
+            return builder.template build<G>();
+        }
+        return GeometryList<Rest...>::build(builder, line_size, sets, ways);
+    }
+};
+
+/// Geometries with a compiled request path. Any other uses CacheGeometry.
+typedef GeometryList<
+    FixedGeometry<8, 16, 8>,     // 1 KB, 8 ways of 8 byte lines
+    FixedGeometry<8, 32, 4>,     // 1 KB, 4 ways
+    FixedGeometry<8, 256, 8>,    // 16 KB, 8 ways
+    FixedGeometry<64, 64, 8>,    // 32 KB, 8 ways of 64 byte lines
+    FixedGeometry<64, 512, 8>,   // 256 KB, 8 ways
+    FixedGeometry<64, 2048, 12>, // 1.5 MB, 12 ways
+    FixedGeometry<64, 2048, 16>  // 2 MB, 16 ways
+> CommonGeometries;
+
+/// The policy class behind each replacement type a fixed cache compiles in
+template <ReplacementPolicy::Type Type>
+struct FixedPolicy;
+
+template <>
+struct FixedPolicy<ReplacementPolicy::LRU>
+{
+    typedef LRUPolicy Class;
+};
+
+template <>
+struct FixedPolicy<ReplacementPolicy::TreePLRU>
+{
+    typedef TreePLRUPolicy Class;
+};
+
+/**
+ * A cache of class Base with its request path compiled for Geometry and
+ * replacement policy Type. Base::access(geometry, policy, ...) is the
+ * request path, so the generic and fixed caches share one body.
+ *
+ * What is compiled in: the set, tag and offset of a request, the tag
+ * compare of its set, the index of its line and the replacement calls of
+ * receiveRequest. Fills from below, evictions, the victim cache, the way
+ * predictor and the hash index still use the runtime geometry and policy.
+ *
+ * Built by Base::create, which is where access is defined. If the policy is
+ * changed with setReplacement, requests take the generic path.
+ */
+template <class Base, class Geometry, ReplacementPolicy::Type Type>
+class FixedCache final : public Base
+{
+  public:
+    template <class... Args>
+    FixedCache(Args&&... args) : Base(std::forward<Args>(args)...)
+    {
+        assert(this->lineSize == Geometry::getLineSize());
+        assert(this->sets == Geometry::getSets());
+        assert(this->way == Geometry::getWays());
+        this->setReplacement(Type);
+    }
+
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override
+    {
+        if (this->replacementType != Type) {
+            return Base::receiveRequest(address, size, data, request_id);
+        }
+        typedef typename FixedPolicy<Type>::Class Policy;
+        return this->access(Geometry(),
+                            *static_cast<Policy*>(this->replacement),
+                            address, size, data, request_id);
+    }
+};
+
+#endif // CSIM_CACHE_GEOMETRY_H
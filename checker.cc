@@ -0,0 +1,160 @@
+#include <cstring>
+#include <iostream>
+
+#include "checker.hh"
+#include "util.hh"
+
+/// Number of events that can be in flight to the checker thread.
+static const int queueEntries = 4096;
+
+Checker::Checker(int addr_bits, int line_size, Mode mode, int sample_rate) :
+    lineSize(line_size), mode(mode), sampleRate(sample_rate),
+    golden(addr_bits, line_size, 1),
+    head(0), tail(0), done(false),
+    sampleCount(0), reads(0), readsChecked(0), writebacks(0),
+    writebacksChecked(0)
+{
+    assert(sampleRate > 0);
+    if (mode == Async) {
+        events.resize(queueEntries);
+        payload.resize(queueEntries * lineSize);
+        thread = std::thread([this]{run();});
+    }
+}
+
+Checker::~Checker()
+{
+    if (mode == Async) {
+        done.store(true, std::memory_order_release);
+        thread.join();
+    }
+    if (reads + writebacks == 0) return;
+    std::cout << "Checked reads: " << readsChecked << " of " << reads;
+    std::cout << std::endl;
+    std::cout << "Checked writebacks: " << writebacksChecked << " of ";
+    std::cout << writebacks << std::endl;
+}
+
+bool
+Checker::sample()
+{
+    if (++sampleCount < sampleRate) return false;
+    sampleCount = 0;
+    return true;
+}
+
+void
+Checker::write(uint64_t address, int size, const uint8_t* data)
+{
+    send(Write, address, size, data);
+}
+
+void
+Checker::checkRead(uint64_t address, int size, const uint8_t* data)
+{
+    reads++;
+    if (!sample()) return;
+    readsChecked++;
+    send(Read, address, size, data);
+}
+
+void
+Checker::checkWriteback(uint64_t address, const uint8_t* data)
+{
+    writebacks++;
+    if (!sample()) return;
+    writebacksChecked++;
+    send(Writeback, address, lineSize, data);
+}
+
+void
+Checker::send(EventType type, uint64_t address, int size, const uint8_t* data)
+{
+    if (mode == Sync) {
+        handle(type, address, size, data);
+        return;
+    }
+
+    uint64_t slot = tail.load(std::memory_order_relaxed);
+    while (slot - head.load(std::memory_order_acquire) == events.size()) {
+        // The checker thread is behind.
+        std::this_thread::yield();
+    }
+
+    int index = slot % events.size();
+    events[index] = {type, size, address};
+    memcpy(&payload[index * lineSize], data, size);
+    tail.store(slot + 1, std::memory_order_release);
+}
+
+void
+Checker::run()
+{
+    uint64_t slot = 0;
+    while (true) {
+        if (slot == tail.load(std::memory_order_acquire)) {
+            // Check done before tail again so no event is missed.
+            if (done.load(std::memory_order_acquire) &&
+                slot == tail.load(std::memory_order_acquire)) {
+                return;
+            }
+            std::this_thread::yield();
+            continue;
+        }
+        int index = slot % events.size();
+        Event &e = events[index];
+        handle(e.type, e.address, e.size, &payload[index * lineSize]);
+        head.store(++slot, std::memory_order_release);
+    }
+}
+
+void
+Checker::handle(EventType type, uint64_t address, int size,
+                const uint8_t* data)
+{
+    uint64_t line_address = address & ~(lineSize - 1);
+    int block_offset = address & (lineSize - 1);
+    uint8_t* line = golden.getLine(line_address);
+
+    switch (type) {
+      case Write:
+        // Write the data to the golden copy.
+        memcpy(line + block_offset, data, size);
+        // Mark that the cache contains dirty data
+        golden.setDirty(line_address, true);
+        break;
+      case Read:
+        if (!compareData(line + block_offset, data, size)) {
+            std::cout << "Address " << std::hex << address << std::endl;
+            std::cout << "ERROR! Read contains wrong data." << std::endl;
+            assert(0); // Assert for easier gdb
+        }
+        break;
+      case Writeback:
+        if (!compareData(line, data, lineSize)) {
+            std::cout << "Address " << std::hex << address << std::endl;
+            std::cout << "ERROR! Writeback contains wrong data." << std::endl;
+            assert(0); // Assert for easier gdb
+        }
+        // Now that it's written back, it's no longer dirty in the cache
+        golden.setDirty(line_address, false);
+        break;
+    }
+}
+
+bool
+Checker::compareData(const uint8_t *correct, const uint8_t *compare, int num)
+{
+    if (memcmp(correct, compare, num) == 0) return true;
+
+    // Only print the details when there is a mismatch.
+    for (int i = 0; i < num; i++) {
+        if (correct[i] != compare[i]) {
+            std::cout << "Mismatch on byte " << i;
+            std::cout << " is " << std::hex << (uint32_t)compare[i];
+            std::cout << " should be " << std::hex << (uint32_t)correct[i];
+            std::cout << std::endl;
+        }
+    }
+    return false;
+}
@@ -0,0 +1,127 @@
+#ifndef CSIM_CHECKER_H
+#define CSIM_CHECKER_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "backing_store.hh"
+
+/**
+ * Holds the golden copy of memory and checks the data the cache returns and
+ * writes back against it.
+ *
+ * In Sync mode every check is done when it is asked for. In Async mode the
+ * checks are put on a single-producer single-consumer queue and a separate
+ * thread owns the golden memory. Events are handled in the order they were
+ * sent, so the result is the same, only a mismatch is reported a little
+ * later.
+ *
+ * Reads and writebacks can be sampled, every write is always applied.
+ */
+class Checker
+{
+  public:
+    enum Mode {
+        Sync,
+        Async
+    };
+
+    /**
+     * @param addr_bits is the number of bits in an address
+     * @param line_size in bytes
+     * @param mode to check in
+     * @param sample_rate check one in every sample_rate reads and writebacks
+     */
+    Checker(int addr_bits, int line_size, Mode mode, int sample_rate);
+
+    /**
+     * Finishes all queued checks and prints the statistics
+     */
+    ~Checker();
+
+    /**
+     * The processor's store completed. Update the golden memory.
+     */
+    void write(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * The processor's load completed. Check the data.
+     */
+    void checkRead(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * A line was written back to memory. Check it is not stale.
+     */
+    void checkWriteback(uint64_t address, const uint8_t* data);
+
+  private:
+    enum EventType {
+        Write,
+        Read,
+        Writeback
+    };
+
+    struct Event {
+        EventType type;
+        int size;
+        uint64_t address;
+    };
+
+    int lineSize;
+    Mode mode;
+    int sampleRate;
+
+    /// Only touched by the checker thread in Async mode.
+    BackingStore golden;
+
+    /// Ring of events. The data for event i is at payload[i * lineSize].
+    std::vector<Event> events;
+    std::vector<uint8_t> payload;
+
+    /// Next event the checker thread will handle
+    std::atomic<uint64_t> head;
+    /// Next free slot for the simulation thread
+    std::atomic<uint64_t> tail;
+    /// Set when there will be no more events
+    std::atomic<bool> done;
+
+    std::thread thread;
+
+    int64_t sampleCount;
+    int64_t reads;
+    int64_t readsChecked;
+    int64_t writebacks;
+    int64_t writebacksChecked;
+
+    /**
+     * @return true if this read or writeback should be checked
+     */
+    bool sample();
+
+    /**
+     * Queue an event for the checker thread, or handle it now in Sync mode.
+     */
+    void send(EventType type, uint64_t address, int size,
+              const uint8_t* data);
+
+    /**
+     * Checks or applies one event against the golden memory.
+     */
+    void handle(EventType type, uint64_t address, int size,
+                const uint8_t* data);
+
+    /**
+     * The checker thread's loop.
+     */
+    void run();
+
+    /**
+     * Returns false if data does not match
+     */
+    static bool compareData(const uint8_t *correct, const uint8_t *compare,
+                            int num);
+};
+
+#endif // CSIM_CHECKER_H
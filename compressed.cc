@@ -0,0 +1,427 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "compressed.hh"
+#include "memory.hh"
+#include "processor.hh"
+#include "util.hh"
+
+CompressedCache::CompressedCache(int64_t size, ResponsePort& memory,
+                                 Processor& processor, int ways,
+                                 int tags_per_way) :
+    Cache(size, memory, processor), ways(ways),
+    sets(size / lineSize / ways),
+    tagsPerSet(ways * tags_per_way),
+    setBytes(ways * lineSize),
+    setIndex(size / lineSize / ways, lineBits),
+    tagBits(setIndex.getTagBits(addrBits)),
+    tagArray(size / lineSize * tags_per_way, 2, tagBits,
+             ways * tags_per_way),
+    dataArray(size / lineSize / ways,
+              ways * lineSize),
+    compressor(lineSize),
+    blocks(size / lineSize * tags_per_way, {0, 0, 0, 0}),
+    usedBytes(size / lineSize / ways, 0), useCount(0),
+    blocked(false), mshr({-1, 0, 0, 0, nullptr}),
+    lineBuffer(lineSize),
+    compressBuffer(lineSize),
+    evictBuffer(lineSize),
+    validLines(0), compressions(0), compressedBytes(0), encodings(),
+    decompressions(0), lineSamples(0)
+{
+    assert(ways > 0);
+    assert(tags_per_way > 0);
+    assert(sets > 0);
+    assert(sets * ways * lineSize == size);
+}
+
+CompressedCache::~CompressedCache()
+{
+    static const char* names[BDICompressor::NumEncodings] = {
+        "raw", "zeros", "repeated", "b8d1", "b8d2", "b8d4", "b4d1", "b4d2",
+        "b2d1"
+    };
+    int64_t accesses = hits + misses;
+    int64_t uncompressed = compressions * lineSize;
+    // The lines held on average, against the lines the data array holds
+    // uncompressed.
+    double held = accesses ? (double)lineSamples / accesses : 0;
+
+    std::cout << name << " compression ratio: "
+              << (compressedBytes ? (double)uncompressed / compressedBytes : 0)
+              << " (" << uncompressed << " bytes in " << compressedBytes
+              << ")" << std::endl;
+    std::cout << name << " encodings:";
+    for (int encoding = 0; encoding < BDICompressor::NumEncodings;
+         encoding++) {
+        std::cout << " " << names[encoding] << ": " << encodings[encoding];
+    }
+    std::cout << std::endl;
+    std::cout << name << " effective capacity: "
+              << held * lineSize << " bytes ("
+              << held << " lines, " << sets * ways << " uncompressed)"
+              << std::endl;
+    std::cout << name << " decompressions: " << decompressions;
+    if (pipeline) {
+        // Without access latency hits are answered right away.
+        std::cout << " adding " << decompressions * decompressLatency
+                  << " ticks";
+    }
+    std::cout << std::endl;
+}
+
+bool
+CompressedCache::receiveRequest(uint64_t address, int size,
+                                const uint8_t* data, int request_id)
+{
+    if (!startRequest(address, size, blocked)) return false;
+
+    int64_t set = getSetIndex(address);
+    uint64_t line_address = address & ~(lineSize - 1);
+    int block_offset = getBlockOffset(address);
+    int way = tagArray.findWay(set, getTag(address));
+    // A parked line is still in the cache, even for writes that would not
+    // allocate.
+    if (way < 0 && writebackBuffer && !unpark(address, way)) {
+        return rejectRequest();
+    }
+    int index = set * tagsPerSet + way;
+
+    if (way >= 0) {
+        Block &block = blocks[index];
+        bool compressed = block.encoding != BDICompressor::Raw;
+        readLine(index, lineBuffer.data());
+
+        if (data) {
+            // Compress the new line first, it may need more room.
+            memcpy(&lineBuffer[block_offset], data, size);
+            int encoding = compressor.compress(lineBuffer.data(),
+                                               compressBuffer.data());
+            int growth = compressor.getSize(encoding) - block.size;
+            if (!makeRoom(set, growth, index)) {
+                return rejectRequest();
+            }
+            if (!writeThroughHit(address, size, data)) return false;
+            DPRINT("Hit in cache");
+            hits++;
+            if (compressed) {
+                // The line has to be decompressed before it is used.
+                decompressions++;
+                extendAccess(decompressLatency);
+            }
+            lineSamples += validLines;
+            freeLine(index);
+            storeLine(index, encoding);
+            // Mark dirty, unless the write already went down
+            if (writePolicy != WriteThrough) {
+                tagArray.setState(index, Dirty);
+            }
+            block.lastUse = ++useCount;
+            sendResponse(request_id, nullptr);
+            if (writePolicy == WriteThrough) drainWrites();
+        } else {
+            DPRINT("Hit in cache");
+            hits++;
+            if (compressed) {
+                // The line has to be decompressed before it is used.
+                decompressions++;
+                extendAccess(decompressLatency);
+            }
+            lineSamples += validLines;
+            block.lastUse = ++useCount;
+            sendResponse(request_id, &lineBuffer[block_offset], size);
+        }
+        return true;
+    }
+
+    if (data && writePolicy != WriteBack) {
+        // Do not allocate, only send the write down.
+        if (!writeAround(address, size, data, request_id)) return false;
+        lineSamples += validLines;
+        return true;
+    }
+
+    DPRINT("Miss in cache");
+    // Older writes to the line must get there before it is read.
+    if (!flushWrites(line_address)) {
+        return rejectRequest();
+    }
+
+    // Make room for the line uncompressed, it is only compressed once it
+    // is here.
+    way = getVictim(set);
+    index = set * tagsPerSet + way;
+    if (tagArray.getState(index) != Invalid && !evictLine(index)) {
+        // Memory is full. The lines that left are written back, so the
+        // processor can retry the request when memory has space.
+        return rejectRequest();
+    }
+    if (!makeRoom(set, lineSize, -1)) {
+        return rejectRequest();
+    }
+    tagArray.setTag(index, getTag(address));
+
+    // Forward to memory and block the cache.
+    // Fill in the MSHR first, a cache below may respond right away.
+    mshr.savedId = request_id;
+    mshr.savedAddr = address;
+    mshr.target = index;
+    // Remember the data if it is a write. It must be copied.
+    mshr.savedSize = size;
+    if (data) {
+        writeBuffer.assign(data, data + size);
+        data = writeBuffer.data();
+    }
+    mshr.savedData = data;
+    blocked = true;
+
+    if (!sendMemRequest(line_address, lineSize, nullptr, 0)) {
+        // The tag is still invalid, so a retry is a plain miss.
+        blocked = false;
+        return rejectRequest();
+    }
+    misses++;
+    lineSamples += validLines;
+    return true;
+}
+
+void
+CompressedCache::receiveMemResponse(int request_id, const uint8_t* data)
+{
+    assert(request_id == 0);
+    assert(data);
+
+    int index = mshr.target;
+    assert(tagArray.getState(index) == Invalid);
+
+    // The fill takes a port of its bank.
+    fillBank(mshr.savedAddr);
+
+    // Apply a write before compressing, the line is only stored once.
+    memcpy(lineBuffer.data(), data, lineSize);
+    int block_offset = getBlockOffset(mshr.savedAddr);
+    if (mshr.savedData) {
+        memcpy(&lineBuffer[block_offset], mshr.savedData, mshr.savedSize);
+    }
+    int encoding = compressor.compress(lineBuffer.data(),
+                                       compressBuffer.data());
+    storeLine(index, encoding);
+    tagArray.setState(index, mshr.savedData ? Dirty : Valid);
+    blocks[index].lastUse = ++useCount;
+    validLines++;
+
+    // Treat as a hit
+    if (mshr.savedData) {
+        sendResponse(mshr.savedId, nullptr);
+    } else {
+        // The line is still uncompressed in lineBuffer
+        sendResponse(mshr.savedId, &lineBuffer[block_offset],
+                     mshr.savedSize);
+    }
+
+    blocked = false;
+    mshr.savedId = -1;
+    mshr.savedAddr = 0;
+    mshr.target = 0;
+    mshr.savedSize = 0;
+    mshr.savedData = nullptr;
+
+    // Let the level above send the request that was blocked.
+    sendRetry();
+}
+
+bool
+CompressedCache::invalidateLine(uint64_t address, uint8_t* data,
+                                bool was_dirty)
+{
+    int64_t set = getSetIndex(address);
+    int way = tagArray.findWay(set, getTag(address));
+    if (way < 0) return was_dirty;
+
+    int index = set * tagsPerSet + way;
+    if (tagArray.getState(index) == Dirty && !was_dirty) {
+        readLine(index, data);
+        was_dirty = true;
+    }
+    freeLine(index);
+    tagArray.setState(index, Invalid);
+    validLines--;
+    return was_dirty;
+}
+
+bool
+CompressedCache::unpark(uint64_t address, int &way)
+{
+    uint64_t line_address = address & ~(lineSize - 1);
+    if (writebackBuffer->find(line_address) < 0) return true;
+
+    // The line stays parked until there is room for it uncompressed.
+    int64_t set = getSetIndex(address);
+    int victim = getVictim(set);
+    int index = set * tagsPerSet + victim;
+    if (tagArray.getState(index) != Invalid && !evictLine(index)) {
+        return false;
+    }
+    if (!makeRoom(set, lineSize, -1)) {
+        return false;
+    }
+
+    // The line never left the cache, take it back.
+    int parked = writebackBuffer->find(line_address);
+    writebackBuffer->hits++;
+    int encoding = compressor.compress(writebackBuffer->getLine(parked),
+                                       compressBuffer.data());
+    writebackBuffer->remove(parked);
+    tagArray.setTag(index, getTag(address));
+    storeLine(index, encoding);
+    tagArray.setState(index, Dirty);
+    blocks[index].lastUse = ++useCount;
+    validLines++;
+    way = victim;
+    return true;
+}
+
+int
+CompressedCache::getVictim(int64_t set)
+{
+    int victim = 0;
+    for (int way = 0; way < tagsPerSet; way++) {
+        int index = set * tagsPerSet + way;
+        if (tagArray.getState(index) == Invalid) return way;
+        if (blocks[index].lastUse < blocks[set * tagsPerSet + victim].lastUse) {
+            victim = way;
+        }
+    }
+    return victim;
+}
+
+int
+CompressedCache::getFreeBytes(int64_t set)
+{
+    return setBytes - usedBytes[set];
+}
+
+void
+CompressedCache::readLine(int index, uint8_t* out)
+{
+    Block &block = blocks[index];
+    uint8_t* set_data = dataArray.getLine(index / tagsPerSet);
+    compressor.decompress(block.encoding, &set_data[block.offset], out);
+}
+
+void
+CompressedCache::storeLine(int index, int encoding)
+{
+    int64_t set = index / tagsPerSet;
+    int size = compressor.getSize(encoding);
+    assert(size <= getFreeBytes(set));
+
+    Block &block = blocks[index];
+    block.offset = usedBytes[set];
+    block.size = size;
+    block.encoding = encoding;
+    memcpy(&dataArray.getLine(set)[block.offset], compressBuffer.data(), size);
+    usedBytes[set] += size;
+
+    compressions++;
+    compressedBytes += size;
+    encodings[encoding]++;
+}
+
+void
+CompressedCache::freeLine(int index)
+{
+    int64_t set = index / tagsPerSet;
+    Block &block = blocks[index];
+    uint8_t* set_data = dataArray.getLine(set);
+    int end = block.offset + block.size;
+
+    // Move the lines after it down over the gap.
+    memmove(&set_data[block.offset], &set_data[end], usedBytes[set] - end);
+    for (int way = 0; way < tagsPerSet; way++) {
+        int other = set * tagsPerSet + way;
+        if (tagArray.getState(other) != Invalid &&
+            blocks[other].offset > block.offset) {
+            blocks[other].offset -= block.size;
+        }
+    }
+    usedBytes[set] -= block.size;
+    block.size = 0;
+}
+
+bool
+CompressedCache::evictLine(int index)
+{
+    uint64_t address = getLineAddress(index);
+    readLine(index, evictBuffer.data());
+    if (tagArray.getState(index) == Dirty) {
+        DPRINT("Dirty, writing back");
+        if (writebackBuffer) {
+            if (writebackBuffer->isFull()) {
+                writebackStalls++;
+                return false;
+            }
+            writebackBuffer->park(address, evictBuffer.data());
+        } else if (!sendMemRequest(address, lineSize,
+                                   evictBuffer.data(), -1)) {
+            // No response for writes, no need for valid request_id
+            return false;
+        }
+        writebacks++;
+    } else {
+        // Let an exclusive level below keep the clean line.
+        sendEviction(address, evictBuffer.data());
+    }
+    freeLine(index);
+    tagArray.setState(index, Invalid);
+    validLines--;
+    return true;
+}
+
+bool
+CompressedCache::makeRoom(int64_t set, int bytes, int keep)
+{
+    while (getFreeBytes(set) < bytes) {
+        int victim = -1;
+        for (int way = 0; way < tagsPerSet; way++) {
+            int index = set * tagsPerSet + way;
+            if (index == keep || tagArray.getState(index) == Invalid) {
+                continue;
+            }
+            if (victim < 0 || blocks[index].lastUse < blocks[victim].lastUse) {
+                victim = index;
+            }
+        }
+        // A set always has room for one uncompressed line.
+        assert(victim >= 0);
+        if (!evictLine(victim)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+int64_t
+CompressedCache::getSetIndex(uint64_t address)
+{
+    return setIndex.getSet(address);
+}
+
+int
+CompressedCache::getBlockOffset(uint64_t address)
+{
+    return address & (lineSize - 1);
+}
+
+uint64_t
+CompressedCache::getTag(uint64_t address)
+{
+    return setIndex.getTag(address);
+}
+
+uint64_t
+CompressedCache::getLineAddress(int index)
+{
+    return setIndex.getAddress(tagArray.getTag(index), index / tagsPerSet);
+}
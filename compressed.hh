@@ -0,0 +1,205 @@
+#ifndef CSIM_COMPRESSED_H
+#define CSIM_COMPRESSED_H
+
+#include <cstdint>
+#include <vector>
+
+#include "bdi.hh"
+#include "cache.hh"
+#include "set_index.hh"
+#include "sram_array.hh"
+#include "tag_array.hh"
+
+/**
+ * A set associative cache that stores its lines compressed with
+ * base-delta-immediate (BDI) compression.
+ *
+ * Each set has room for the data of ways uncompressed lines but more tags
+ * than that, so a set holds extra lines when they compress well. The
+ * compressed lines of a set are packed one after another in its data and
+ * the set is compacted whenever a line leaves or changes size. Lines are
+ * replaced in LRU order until both a tag and enough bytes are free.
+ *
+ * Blocking, like SetAssociativeCache.
+ */
+class CompressedCache: public Cache
+{
+  public:
+    /**
+     * @param size the *total* size of the data array in bytes
+     * @param memory the memory or cache that is below this cache
+     * @param processor the processor this cache is connected to
+     * @param ways the number of uncompressed lines that fit in a set
+     * @param tags_per_way the number of tags for each way, so a set holds
+     *        up to ways * tags_per_way lines
+     */
+    CompressedCache(int64_t size, ResponsePort& memory, Processor& processor,
+                    int ways, int tags_per_way = 2);
+
+    /**
+     * Prints the compression ratio, effective capacity and decompressions
+     */
+    ~CompressedCache() override;
+
+    /**
+     * Called when the processors sends load or store request.
+     * All requests can be assummed to be naturally aligned (e.g., a 4 byte
+     * request will be aligned to a 4 byte boundary)
+     *
+     * @param address of the request
+     * @param size in bytes of the request.
+     * @param data is non-null, then this is a store request.
+     * @param request_id the id that must be used when replying to this request
+     *
+     * @return true if the request can be received, false if the cache is
+     *         blocked and the request must be retried later.
+     */
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    /**
+     * Called when memory has the line of the blocking miss.
+     *
+     * @param request_id is the id assigned to this request in sendMemRequest
+     * @param data is the data from memory (length of data is line length)
+     *        NOTE: This pointer will be invalid when this function returns.
+     */
+    void receiveMemResponse(int request_id, const uint8_t* data) override;
+
+    /**
+     * Store each tag and state in exactly the bits they need.
+     */
+    void setPackedTags(bool packed) { tagArray.setPacked(packed); }
+
+  private:
+    bool invalidateLine(uint64_t address, uint8_t* data,
+                        bool was_dirty) override;
+
+    /// Ticks a hit on a line that is not stored raw takes longer, with
+    /// setHitLatency
+    static const int decompressLatency = 1;
+
+    enum State {
+        Invalid = 0,
+        Valid = 1,
+        Dirty = 3 // Dirty implies valid
+    };
+
+    /// Where a line is in the data of its set
+    struct Block {
+        int offset;
+        int size;
+        int encoding;
+        uint64_t lastUse;
+    };
+
+    int64_t getSetIndex(uint64_t address);
+    int getBlockOffset(uint64_t address);
+    uint64_t getTag(uint64_t address);
+    uint64_t getLineAddress(int index);
+
+    /// @return the first free tag of set, or the least recently used
+    int getVictim(int64_t set);
+
+    /// @return the bytes of set that no line uses
+    int getFreeBytes(int64_t set);
+
+    /// Decompress the line at index into out
+    void readLine(int index, uint8_t* out);
+
+    /**
+     * Copy compressBuffer, holding a line compressed with encoding, to the
+     * end of the data of the set of index. There must be room for it.
+     */
+    void storeLine(int index, int encoding);
+
+    /// Free the data of the line at index and compact its set
+    void freeLine(int index);
+
+    /**
+     * Take the line of address back out of the writeback buffer if it is
+     * parked there.
+     *
+     * @param way set to the tag the line is in if it was parked
+     * @return false if memory is full
+     */
+    bool unpark(uint64_t address, int &way);
+
+    /**
+     * Write back or pass on the line at index and invalidate it.
+     *
+     * @return false if memory is full
+     */
+    bool evictLine(int index);
+
+    /**
+     * Evict lines of set, least recently used first, until bytes bytes are
+     * free. The line at keep is never evicted.
+     *
+     * @return false if memory is full
+     */
+    bool makeRoom(int64_t set, int bytes, int keep);
+
+    int ways;
+    int64_t sets;
+    int tagsPerSet;
+
+    /// Bytes of data in each set
+    int setBytes;
+
+    /// Splits addresses into set and tag
+    SetIndex setIndex;
+
+    /// Number of tag bits in the address
+    int64_t tagBits;
+
+    TagArray tagArray;
+
+    /// One row of setBytes bytes for each set
+    SRAMArray dataArray;
+
+    BDICompressor compressor;
+
+    /// One for each tag
+    std::vector<Block> blocks;
+
+    /// Bytes used in each set
+    std::vector<int> usedBytes;
+
+    uint64_t useCount;
+
+    /// If true, the cache is waiting for a line
+    bool blocked;
+
+    struct MSHR {
+        int savedId;
+        uint64_t savedAddr;
+        int target; // tag the line is filled into
+        int savedSize;
+        const uint8_t* savedData;
+    };
+
+    MSHR mshr;
+
+    /// Copy of the data of a write miss. savedData points here.
+    std::vector<uint8_t> writeBuffer;
+
+    /// The uncompressed line being read or written
+    std::vector<uint8_t> lineBuffer;
+
+    /// lineBuffer after compression
+    std::vector<uint8_t> compressBuffer;
+
+    /// The uncompressed line being evicted
+    std::vector<uint8_t> evictBuffer;
+
+    int64_t validLines;
+
+    int64_t compressions; // lines stored
+    int64_t compressedBytes;
+    int64_t encodings[BDICompressor::NumEncodings];
+    int64_t decompressions; // reads of lines that are not raw
+    int64_t lineSamples; // valid lines summed at every access
+};
+
+#endif // CSIM_COMPRESSED_H
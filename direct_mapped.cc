@@ -6,58 +6,54 @@
 #include "processor.hh"
 #include "util.hh"
 
-DirectMappedCache::DirectMappedCache(int64_t size, Memory& memory,
+DirectMappedCache::DirectMappedCache(int64_t size, ResponsePort& memory,
                                      Processor& processor) :
     Cache(size, memory, processor),
-    tagBits(processor.getAddrSize() - log2int(size / memory.getLineSize()) -
-            memory.getLineBits()),
-    indexMask(size / memory.getLineSize() - 1),
-    tagArray(size / memory.getLineSize(), // Lines
+    setIndex(size / lineSize, lineBits),
+    tagBits(setIndex.getTagBits(addrBits)),
+    tagArray(size / lineSize, // Lines
          2, // 1 bit for valid, 1 bit for dirty.
          tagBits), // Bits for the tag
-    dataArray(size / memory.getLineSize(), memory.getLineSize()),
+    dataArray(size / lineSize, lineSize),
     blocked(false), mshr({-1,0,0,nullptr})
 {
-
+    assert(size / lineSize * lineSize == size);
 }
 
 int64_t
 DirectMappedCache::getIndex(uint64_t address)
 {
-    return (address >> memory.getLineBits()) & indexMask;
+    return setIndex.getSet(address);
 }
 
 int
 DirectMappedCache::getBlockOffset(uint64_t address)
 {
-    return address & (memory.getLineSize() - 1);
+    return address & (lineSize - 1);
 }
 
 uint64_t
 DirectMappedCache::getTag(uint64_t address)
 {
-    return address >> (processor.getAddrSize() - tagBits);
+    return setIndex.getTag(address);
 }
 
 bool
 DirectMappedCache::receiveRequest(uint64_t address, int size,
                                   const uint8_t* data, int request_id)
 {
-    assert(size <= memory.getLineSize()); // within line size
-    // within address range
-    assert(address < ((uint64_t)1 << processor.getAddrSize()));
-    assert((address &  (size - 1)) == 0); // naturally aligned
-
-    if (blocked) {
-        DPRINT("Cache is blocked!");
-        // Cache is currently blocked, so it cannot receive a new request
-        return false;
-    }
+    if (!startRequest(address, size, blocked)) return false;
 
     int index = getIndex(address);
+    uint64_t block_address = address & ~(lineSize -1);
 
+    if (!hit(address) && writebackBuffer) {
+        unpark(block_address);
+    }
     if (hit(address)) {
+        if (!writeThroughHit(address, size, data)) return false;
         DPRINT("Hit in cache");
+        hits++;
         // get a pointer to the data
         uint8_t* line = dataArray.getLine(index);
 
@@ -67,42 +63,78 @@ DirectMappedCache::receiveRequest(uint64_t address, int size,
             // if this is a write, copy the data into the cache.
             memcpy(&line[block_offset], data, size);
             sendResponse(request_id, nullptr);
-            // Mark dirty
-            tagArray.setState(index, Dirty);
+            // Mark dirty, unless the write already went down
+            if (writePolicy != WriteThrough) {
+                tagArray.setState(index, Dirty);
+            }
         } else {
             // This is a read so we need to return data
-            sendResponse(request_id, &line[block_offset]);
+            sendResponse(request_id, &line[block_offset], size);
         }
+        if (data && writePolicy == WriteThrough) drainWrites();
+    } else if (data && writePolicy != WriteBack) {
+        // Do not allocate, only send the write down.
+        return writeAround(address, size, data, request_id);
     } else {
         DPRINT("Miss in cache " << tagArray.getState(index));
+        // Older writes to the line must get there before it is read.
+        if (!flushWrites(block_address)) {
+            return rejectRequest();
+        }
         if (dirty(address)) {
             DPRINT("Dirty, writing back");
             // If the line is dirty, then we need to evict it.
             uint8_t* line = dataArray.getLine(index);
             // Calculate the address of the writeback.
             uint64_t wb_address =
-                tagArray.getTag(index) << (processor.getAddrSize() - tagBits);
-            wb_address |= (index << memory.getLineBits());
-            // No response for writes, no need for valid request_id
-            sendMemRequest(wb_address, memory.getLineSize(), line, -1);
+                setIndex.getAddress(tagArray.getTag(index), index);
+            if (writebackBuffer) {
+                if (writebackBuffer->isFull()) {
+                    writebackStalls++;
+                    return rejectRequest();
+                }
+                writebackBuffer->park(wb_address, line);
+            } else if (!sendMemRequest(wb_address, lineSize,
+                                       line, -1)) {
+                // No response for writes, no need for valid request_id.
+                // Memory is full. Nothing has changed yet, so the processor
+                // can retry the whole request when memory has space.
+                return rejectRequest();
+            }
+            writebacks++;
+        } else if (tagArray.getState(index) == Valid) {
+            // Let an exclusive level below keep the clean line.
+            uint64_t victim =
+                setIndex.getAddress(tagArray.getTag(index), index);
+            sendEviction(victim, dataArray.getLine(index));
         }
         // Mark the line invalid.
         tagArray.setState(index, Invalid);
         // Forward to memory and block the cache.
         // no need for req id since there is only one outstanding request.
         // We need to read whether the request is a read or write.
-        uint64_t block_address = address & ~(memory.getLineSize() -1);
-        sendMemRequest(block_address, memory.getLineSize(), nullptr, 0);
 
+        // Fill in the MSHR first, a cache below may respond right away.
         // remember the CPU's request id
         mshr.savedId = request_id;
         // Remember the address
         mshr.savedAddr = address;
-        // Remember the data if it is a write.
+        // Remember the data if it is a write. It must be copied.
         mshr.savedSize = size;
+        if (data) {
+            writeBuffer.assign(data, data + size);
+            data = writeBuffer.data();
+        }
         mshr.savedData = data;
         // Mark the cache as blocked
         blocked = true;
+
+        if (!sendMemRequest(block_address, lineSize, nullptr, 0)) {
+            // The line is clean and invalid now, so a retry is a plain miss.
+            blocked = false;
+            return rejectRequest();
+        }
+        misses++;
     }
 
     // We have accepted the request, so return true.
@@ -117,9 +149,12 @@ DirectMappedCache::receiveMemResponse(int request_id, const uint8_t* data)
 
     int index = getIndex(mshr.savedAddr);
 
+    // The fill takes a port of its bank.
+    fillBank(mshr.savedAddr);
+
     // Copy the data into the cache.
     uint8_t* line = dataArray.getLine(index);
-    memcpy(line, data, memory.getLineSize());
+    memcpy(line, data, lineSize);
 
     assert(tagArray.getState(index) == Invalid);
 
@@ -140,7 +175,7 @@ DirectMappedCache::receiveMemResponse(int request_id, const uint8_t* data)
         tagArray.setState(index, Dirty);
     } else {
         // This is a read so we need to return data
-        sendResponse(mshr.savedId, &line[block_offset]);
+        sendResponse(mshr.savedId, &line[block_offset], mshr.savedSize);
     }
 
     blocked = false;
@@ -148,6 +183,52 @@ DirectMappedCache::receiveMemResponse(int request_id, const uint8_t* data)
     mshr.savedAddr = 0;
     mshr.savedSize = 0;
     mshr.savedData = nullptr;
+
+    // Let the level above send the request that was blocked.
+    sendRetry();
+}
+
+bool
+DirectMappedCache::invalidateLine(uint64_t address, uint8_t* data,
+                                  bool was_dirty)
+{
+    if (!hit(address)) return was_dirty;
+
+    int index = getIndex(address);
+    if (dirty(address) && !was_dirty) {
+        memcpy(data, dataArray.getLine(index), lineSize);
+        was_dirty = true;
+    }
+    tagArray.setState(index, Invalid);
+    return was_dirty;
+}
+
+void
+DirectMappedCache::unpark(uint64_t address)
+{
+    int entry = writebackBuffer->find(address);
+    if (entry < 0) return;
+    writebackBuffer->hits++;
+
+    // The parked line leaves first, so its entry has room for a dirty line
+    // it replaces.
+    parkedLine.assign(writebackBuffer->getLine(entry),
+                      writebackBuffer->getLine(entry) + lineSize);
+    writebackBuffer->remove(entry);
+
+    int index = getIndex(address);
+    uint8_t* line = dataArray.getLine(index);
+    uint64_t victim = setIndex.getAddress(tagArray.getTag(index), index);
+    if (dirty(address)) {
+        writebackBuffer->park(victim, line);
+        writebacks++;
+    } else if (tagArray.getState(index) == Valid) {
+        sendEviction(victim, line);
+    }
+
+    memcpy(line, parkedLine.data(), lineSize);
+    tagArray.setTag(index, getTag(address));
+    tagArray.setState(index, Dirty);
 }
 
 bool
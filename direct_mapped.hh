@@ -3,9 +3,11 @@
 #define CSIM_DIRECT_MAPPED_H
 
 #include <cstdint>
+#include <vector>
 
 #include "cache.hh"
 #include "tag_array.hh"
+#include "set_index.hh"
 #include "sram_array.hh"
 
 class DirectMappedCache: public Cache
@@ -13,10 +15,10 @@ class DirectMappedCache: public Cache
   public:
     /**
     * @param size is the *total* size of the cache in bytes
-    * @param the memory that is below this cache
+    * @param the memory or cache that is below this cache
     * @param processor this cache is connected tos
     */
-    DirectMappedCache(int64_t size, Memory& memory, Processor& processor);
+    DirectMappedCache(int64_t size, ResponsePort& memory, Processor& processor);
 
     /**
      * Called when the processors sends load or store request.
@@ -44,7 +46,14 @@ class DirectMappedCache: public Cache
      */
     void receiveMemResponse(int request_id, const uint8_t* data) override;
 
+    /**
+     * Store each tag and state in exactly the bits they need.
+     */
+    void setPackedTags(bool packed) { tagArray.setPacked(packed); }
+
   private:
+    bool invalidateLine(uint64_t address, uint8_t* data,
+                        bool was_dirty) override;
 
     enum State {
         Invalid=0,
@@ -78,12 +87,18 @@ class DirectMappedCache: public Cache
      */
     bool dirty(uint64_t address);
 
+    /**
+     * On a miss, move the line at address back from the writeback buffer
+     * if it is parked there, evicting the line in its place.
+     */
+    void unpark(uint64_t address);
+
+    /// Splits addresses into set and tag
+    SetIndex setIndex;
+
     /// Number of tag bits in the address
     int64_t tagBits;
 
-    /// Mask for getting the index bits
-    uint64_t indexMask;
-
     /// The cache's tag array
     TagArray tagArray;
 
@@ -108,6 +123,12 @@ class DirectMappedCache: public Cache
     };
 
     MSHR mshr;
+
+    /// Copy of the data of a write miss. savedData points here.
+    std::vector<uint8_t> writeBuffer;
+
+    /// Line moving out of the writeback buffer
+    std::vector<uint8_t> parkedLine;
 };
 
 #endif // CSIM_DIRECT_MAPPED_H
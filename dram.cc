@@ -0,0 +1,135 @@
+#include <algorithm>
+#include <iostream>
+
+#include "dram.hh"
+#include "util.hh"
+
+DRAM::DRAM(const DRAMParams &params, int line_size) :
+    params(params),
+    columnBits(log2int(params.rowSize)),
+    bankBits(log2int(params.banks)),
+    rankBits(log2int(params.ranks)),
+    busFreeAt(0), lastTick(0)
+{
+    assert(params.rowSize >= line_size);
+    assert(params.tRAS >= params.tRCD);
+    assert(params.tREFI > params.tRFC);
+
+    banks.resize(params.ranks * params.banks,
+                 {-1, 0, 0, 0, 0, 0, 0, 0, 0, 0});
+}
+
+DRAM::~DRAM()
+{
+    std::cout << "DRAM " << (params.pagePolicy == DRAMParams::OpenPage ?
+                             "open" : "closed") << " page, ";
+    std::cout << "refreshes per rank: " << lastTick / params.tREFI;
+    std::cout << std::endl;
+    for (int r = 0; r < params.ranks; r++) {
+        for (int b = 0; b < params.banks; b++) {
+            Bank &bank = banks[r * params.banks + b];
+            if (bank.reads + bank.writes == 0) continue;
+            std::cout << "  rank" << r << " bank" << b;
+            std::cout << ": reads " << bank.reads;
+            std::cout << " writes " << bank.writes;
+            std::cout << " row hits " << bank.rowHits;
+            std::cout << " misses " << bank.rowMisses;
+            std::cout << " conflicts " << bank.rowConflicts;
+            std::cout << " refresh closes " << bank.refreshCloses;
+            std::cout << std::endl;
+        }
+    }
+}
+
+void
+DRAM::decode(uint64_t address, int &bank, int64_t &row)
+{
+    uint64_t a = address >> columnBits;
+    int bank_in_rank = a & (params.banks - 1);
+    a >>= bankBits;
+    int rank = a & (params.ranks - 1);
+    a >>= rankBits;
+    row = a;
+    bank = rank * params.banks + bank_in_rank;
+}
+
+int64_t
+DRAM::refresh(Bank &bank, int64_t start)
+{
+    int64_t epoch = start / params.tREFI;
+    if (epoch > bank.refreshEpoch) {
+        // A refresh precharges every bank in the rank.
+        if (bank.openRow != -1) bank.refreshCloses++;
+        bank.openRow = -1;
+        bank.refreshEpoch = epoch;
+    }
+    if (epoch > 0 && start % params.tREFI < params.tRFC) {
+        // The rank is busy refreshing, wait for it to finish.
+        start = epoch * params.tREFI + params.tRFC;
+    }
+    return start;
+}
+
+bool
+DRAM::rowHit(uint64_t address)
+{
+    int index;
+    int64_t row;
+    decode(address, index, row);
+    return banks[index].openRow == row;
+}
+
+int64_t
+DRAM::access(uint64_t address, bool write, int64_t now)
+{
+    int index;
+    int64_t row;
+    decode(address, index, row);
+    Bank &bank = banks[index];
+
+    int64_t start = refresh(bank, std::max(now, bank.readyAt));
+    lastTick = std::max(lastTick, start);
+
+    int64_t column; // tick the column command is issued
+    if (bank.openRow == row) {
+        bank.rowHits++;
+        column = start;
+    } else {
+        int64_t activate = start;
+        if (bank.openRow == -1) {
+            bank.rowMisses++;
+        } else {
+            bank.rowConflicts++;
+            // Precharge the open row first.
+            int64_t precharge = std::max(start,
+                                         bank.activatedAt + params.tRAS);
+            activate = precharge + params.tRP;
+        }
+        bank.openRow = row;
+        bank.activatedAt = activate;
+        column = activate + params.tRCD;
+    }
+
+    // The data needs the channel's bus.
+    int64_t data = std::max(column + params.tCAS, busFreeAt);
+    int64_t done = data + params.tBURST;
+    busFreeAt = done;
+
+    if (params.pagePolicy == DRAMParams::ClosedPage) {
+        // Auto-precharge once the row has been open long enough.
+        int64_t precharge = std::max(done, bank.activatedAt + params.tRAS);
+        bank.readyAt = precharge + params.tRP;
+        bank.openRow = -1;
+    } else {
+        // Column commands to an open row can be pipelined.
+        bank.readyAt = column + params.tBURST;
+    }
+
+    if (write) {
+        bank.writes++;
+    } else {
+        bank.reads++;
+    }
+
+    return done;
+}
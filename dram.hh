@@ -0,0 +1,118 @@
+#ifndef CSIM_DRAM_H
+#define CSIM_DRAM_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Configuration of the DRAM timing model. All timings are in ticks.
+ */
+struct DRAMParams
+{
+    enum PagePolicy {
+        OpenPage,  // Leave the row open after an access
+        ClosedPage // Precharge the bank as soon as the access is done
+    };
+
+    int ranks = 1;
+    int banks = 8; // per rank
+
+    /// Bytes in one row of one bank
+    int rowSize = 2048;
+
+    int tRCD = 4;  // activate to column command
+    int tCAS = 4;  // column command to data
+    int tRP = 4;   // precharge to activate
+    int tRAS = 10; // activate to precharge
+    int tBURST = 2; // data bus time for one line
+
+    int tREFI = 2000; // time between refreshes of a rank
+    int tRFC = 30;    // time a refresh blocks the rank
+
+    PagePolicy pagePolicy = OpenPage;
+};
+
+/**
+ * A bank-level DRAM timing model of one channel.
+ *
+ * Addresses are mapped row:rank:bank:column so that consecutive lines fall
+ * into the same row and consecutive rows spread over the banks. Channels are
+ * handled by Memory, which gives each channel its own DRAM.
+ * Every bank tracks its open row and when it can next accept a command. The
+ * model keeps no data, it only says when an access finishes.
+ */
+class DRAM
+{
+  public:
+    /**
+     * @param params timings and geometry of the DRAM
+     * @param line_size is the size of each access in bytes
+     */
+    DRAM(const DRAMParams &params, int line_size);
+
+    /**
+     * Prints the per-bank statistics
+     */
+    ~DRAM();
+
+    /**
+     * Performs an access to the bank that holds address.
+     *
+     * @param address of the line
+     * @param write is true for writebacks
+     * @param now is the current tick
+     *
+     * @return the tick when the line has finished transferring
+     */
+    int64_t access(uint64_t address, bool write, int64_t now);
+
+    /**
+     * @return true if an access to address would hit in an open row
+     */
+    bool rowHit(uint64_t address);
+
+  private:
+    struct Bank {
+        int64_t openRow; // -1 if the bank is precharged
+        int64_t readyAt; // tick the bank can take its next command
+        int64_t activatedAt; // tick the open row was activated
+        int64_t refreshEpoch; // last refresh interval the bank has seen
+
+        int64_t reads;
+        int64_t writes;
+        int64_t rowHits;
+        int64_t rowMisses; // bank was precharged
+        int64_t rowConflicts; // a different row was open
+        int64_t refreshCloses; // open row was closed by a refresh
+    };
+
+    DRAMParams params;
+
+    int columnBits;
+    int bankBits;
+    int rankBits;
+
+    /// All banks, indexed by rank * banks + bank
+    std::vector<Bank> banks;
+
+    /// Tick the channel's data bus is free
+    int64_t busFreeAt;
+
+    /// Latest tick any access started. Used to count refreshes.
+    int64_t lastTick;
+
+    /**
+     * Splits the address into its bank index and row.
+     */
+    void decode(uint64_t address, int &bank, int64_t &row);
+
+    /**
+     * Delays start until the bank's rank is not refreshing and closes the
+     * open row if a refresh happened since the bank's last access.
+     *
+     * @return the first tick at or after start the bank can be used
+     */
+    int64_t refresh(Bank &bank, int64_t start);
+};
+
+#endif // CSIM_DRAM_H
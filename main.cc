@@ -1,9 +1,14 @@
 
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <memory>
 
 #include "direct_mapped.hh"
 #include "set_assoc.hh"
 #include "non_blocking.hh"
+#include "sectored.hh"
+#include "compressed.hh"
 #include "memory.hh"
 #include "processor.hh"
 #include "record_store.hh"
@@ -11,14 +16,31 @@
 int main(int argc, char *argv[])
 {
     const char* recordFile = "test2.txt";
-    if (argc == 2) {
+    int addrBits = 32;
+    const char* config = "default";
+    if (argc >= 2) {
         recordFile = argv[1];
-    } else if (argc > 2) {
-        std::cout << "Usage: cache_simulator [records file]" << std::endl;
+    }
+    if (argc >= 3) {
+        addrBits = atoi(argv[2]);
+    }
+    if (argc >= 4) {
+        config = argv[3];
+    }
+    if (argc > 4 || addrBits <= 0 || addrBits > 64) {
+        std::cout << "Usage: cache_simulator [records file] [address bits] "
+                  << "[default|late_prefetch|parked]";
+        std::cout << std::endl;
+        return 1;
     }
 
-    Processor p(32);
-    Memory m(8);
+    Processor p(addrBits);
+    Memory m(8, addrBits);
+    //m.setChannels(2, Memory::LineInterleave);
+    //m.setDRAM(DRAMParams());
+    //m.setController(MemCtrlParams());
+    //m.setBurst(8);
+    //m.setVerification(Checker::Async, 1);
     RecordStore records(recordFile);
     if (!records.loadRecords()) {
         std::cerr << "Could not load file: " << recordFile << std::endl;
@@ -26,11 +48,56 @@ int main(int argc, char *argv[])
     }
     p.setMemory(&m);
     p.setRecords(&records);
-    //DirectMappedCache c(1 << 10, m, p);
-    //SetAssociativeCache s(1 << 10, m, p, 8);
-    NonBlockingCache n(1 << 10, m, p, 8, 4);
+    // Caches are built from the bottom up, and destroyed top first.
+    std::unique_ptr<Cache> l2;
+    std::unique_ptr<Cache> l1;
+    if (strcmp(config, "late_prefetch") == 0) {
+        // Under WriteThrough with a NextLine prefetcher, both stores of
+        // test_late_prefetch.txt must be buffered writes.
+        NonBlockingCache *n = new NonBlockingCache(1 << 10, m, p, 8, 4);
+        n->setPrefetcher(Prefetcher::NextLine);
+        n->setWritePolicy(Cache::WriteThrough);
+        l1.reset(n);
+    } else if (strcmp(config, "parked") == 0) {
+        // test_parked.txt stores to lines parked in a writeback buffer that
+        // cannot drain past a blocked level below.
+        l2.reset(new SetAssociativeCache(1 << 12, m, p, 4));
+        SectoredCache *s = new SectoredCache(512, *l2, p, 2, 4);
+        s->setWritePolicy(Cache::NoWriteAllocate);
+        s->setWritebackBuffer(1);
+        l1.reset(s);
+    } else if (strcmp(config, "default") == 0) {
+        //DirectMappedCache c(1 << 10, m, p);
+        //SetAssociativeCache s(1 << 10, m, p, 8);
+        //SetAssociativeCache s(3 << 10, m, p, 12);
+        //SectoredCache s(1 << 10, m, p, 4, 4);
+        //CompressedCache s(1 << 10, m, p, 4, 2);
+        // With an L2:
+        //NonBlockingCache l2(1 << 14, m, p, 8, 8);
+        //l2.setInclusion(Cache::Inclusive);
+        //l2.setName("L2");
+        //NonBlockingCache n(1 << 10, l2, p, 8, 4);
+        // create compiles the request path in for common geometries
+        NonBlockingCache *n = NonBlockingCache::create(1 << 10, m, p, 8, 4);
+        //n->setReplacement(ReplacementPolicy::TreePLRU);
+        //n->setHashedLookup(true);
+        //n->setPackedTags(true);
+        //n->setTargetsPerMSHR(8);
+        //n->setPrefetcher(Prefetcher::Stream, 4);
+        //n->setVictimCache(8);
+        //n->setWayPrediction(WayPredictor::MRU);
+        //n->setWritePolicy(Cache::WriteCombining);
+        //n->setWritebackBuffer(8);
+        //n->setBanks(4, 1);
+        //n->setHitLatency(1, 2);
+        l1.reset(n);
+    } else {
+        std::cerr << "Unknown configuration: " << config << std::endl;
+        return 1;
+    }
     p.scheduleForSimulation();
 
+    std::cout << "Tag match: " << TagArray::getKernelName() << std::endl;
     std::cout << "Running simulation" << std::endl;
     TickedObject::runSimulation();
     std::cout << "Simulation done" << std::endl;
@@ -41,5 +108,9 @@ int main(int argc, char *argv[])
     std::cout << "Tag size: ";
     std::cout << ((float)TagArray::getTotalSize())/1024 << "KB" << std::endl;
 
+    std::cout << "Replacement size: ";
+    std::cout << ((float)ReplacementPolicy::getTotalSize())/1024 << "KB";
+    std::cout << std::endl;
+
     return 0;
 }
@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <iostream>
+
+#include "mem_ctrl.hh"
+#include "util.hh"
+
+MemoryController::MemoryController(const MemCtrlParams &params, int line_size,
+                                   DRAM *dram) :
+    params(params), dram(dram),
+    transferTicks((line_size + params.bytesPerTick - 1) / params.bytesPerTick),
+    busFreeAt(0), draining(false), issueScheduled(false),
+    reads(0), writes(0), rejected(0), rowHitsFirst(0), drains(0),
+    busyTicks(0), readQueueTicks(0), lastTick(0)
+{
+    assert(params.readQueue > 0);
+    assert(params.writeQueue > 0);
+    assert(params.writeLow < params.writeHigh);
+    assert(params.writeHigh <= params.writeQueue);
+    assert(params.bytesPerTick > 0);
+}
+
+MemoryController::~MemoryController()
+{
+    std::cout << "Controller reads: " << reads << " writes: " << writes;
+    std::cout << " rejected: " << rejected << std::endl;
+    std::cout << "Controller row hits first: " << rowHitsFirst;
+    std::cout << " write drains: " << drains << std::endl;
+    if (reads) {
+        std::cout << "Controller avg read queue ticks: ";
+        std::cout << (float)readQueueTicks / reads << std::endl;
+    }
+    if (lastTick) {
+        std::cout << "Controller bus utilization: ";
+        std::cout << (float)busyTicks / lastTick << std::endl;
+    }
+}
+
+bool
+MemoryController::canAccept(bool write)
+{
+    bool space;
+    if (write) {
+        space = (int)writeQueue.size() < params.writeQueue;
+    } else {
+        space = (int)readQueue.size() < params.readQueue;
+    }
+    // Only asked right before queueing, so a full queue is a rejection.
+    if (!space) rejected++;
+    return space;
+}
+
+void
+MemoryController::enqueue(uint64_t address, bool write,
+                          const std::function<void(void)>& respond)
+{
+    if (write) {
+        assert((int)writeQueue.size() < params.writeQueue);
+        writeQueue.push_back({address, curTick(), respond});
+    } else {
+        assert((int)readQueue.size() < params.readQueue);
+        readQueue.push_back({address, curTick(), respond});
+    }
+    scheduleIssue();
+}
+
+void
+MemoryController::scheduleIssue()
+{
+    if (issueScheduled) return;
+    if (readQueue.empty() && writeQueue.empty()) return;
+
+    issueScheduled = true;
+    schedule(std::max(busFreeAt - curTick(), (int64_t)0), [this]{issue();});
+}
+
+int
+MemoryController::pick(std::deque<Request> &queue)
+{
+    if (!dram) return 0;
+    // First ready: the oldest request that hits an open row.
+    for (int i = 0; i < (int)queue.size(); i++) {
+        if (dram->rowHit(queue[i].address)) return i;
+    }
+    // Otherwise first come first serve.
+    return 0;
+}
+
+void
+MemoryController::issue()
+{
+    issueScheduled = false;
+
+    if (!draining && (int)writeQueue.size() >= params.writeHigh) {
+        draining = true;
+        drains++;
+    } else if (draining && (int)writeQueue.size() <= params.writeLow) {
+        draining = false;
+    }
+
+    bool write = draining || readQueue.empty();
+    std::deque<Request> &queue = write ? writeQueue : readQueue;
+    assert(!queue.empty());
+
+    int index = pick(queue);
+    Request req = queue[index];
+    queue.erase(queue.begin() + index);
+
+    int64_t now = curTick();
+    int64_t done;
+    if (dram) {
+        done = dram->access(req.address, write, now);
+    } else {
+        done = now + 10 + now % 10;
+    }
+
+    // The bus is busy until the line is transferred.
+    busFreeAt = now + transferTicks;
+    busyTicks += transferTicks;
+    lastTick = busFreeAt;
+
+    if (write) {
+        writes++;
+    } else {
+        reads++;
+        readQueueTicks += now - req.arrival;
+        if (index > 0) rowHitsFirst++;
+        schedule(std::max(done, busFreeAt) - now, req.respond);
+    }
+
+    // There is now space in the queue.
+    if (retry) retry();
+
+    scheduleIssue();
+}
@@ -0,0 +1,128 @@
+#ifndef CSIM_MEM_CTRL_H
+#define CSIM_MEM_CTRL_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+
+#include "dram.hh"
+#include "ticked_object.hh"
+
+/**
+ * Configuration of the memory controller.
+ */
+struct MemCtrlParams
+{
+    int readQueue = 16;  // entries in the read queue
+    int writeQueue = 16; // entries in the write queue
+
+    /// Start draining writes when this many are queued...
+    int writeHigh = 12;
+    /// ...and go back to reads when this few are left.
+    int writeLow = 4;
+
+    /// Bandwidth of the memory bus
+    int bytesPerTick = 4;
+};
+
+/**
+ * A memory controller with finite read and write queues.
+ *
+ * Requests are issued one at a time at the rate the bus bandwidth allows.
+ * Reads are scheduled first-ready first-come-first-serve: the oldest read
+ * that hits an open DRAM row goes first, otherwise the oldest read. Writes
+ * are issued when there are no reads, or in a burst once the write queue
+ * passes its high watermark.
+ */
+class MemoryController : public TickedObject
+{
+  public:
+    /**
+     * @param params sizes of the queues and the bus bandwidth
+     * @param line_size in bytes of every request
+     * @param dram timing model. If nullptr reads take 10-19 ticks.
+     */
+    MemoryController(const MemCtrlParams &params, int line_size, DRAM *dram);
+
+    /**
+     * Prints the controller statistics
+     */
+    ~MemoryController();
+
+    /**
+     * @return true if the queue for this type of request has a free entry
+     */
+    bool canAccept(bool write);
+
+    /**
+     * Queues a request. canAccept(write) must be true.
+     *
+     * @param address of the line
+     * @param write is true for writebacks
+     * @param respond is called when a read's data is ready
+     */
+    void enqueue(uint64_t address, bool write,
+                 const std::function<void(void)>& respond);
+
+    /**
+     * Called every time a queue entry is freed.
+     */
+    void setRetry(const std::function<void(void)>& retry) {
+        this->retry = retry;
+    }
+
+    void setDRAM(DRAM *dram) { this->dram = dram; }
+
+  private:
+    struct Request {
+        uint64_t address;
+        int64_t arrival;
+        std::function<void(void)> respond;
+    };
+
+    MemCtrlParams params;
+    DRAM *dram;
+
+    std::deque<Request> readQueue;
+    std::deque<Request> writeQueue;
+
+    std::function<void(void)> retry;
+
+    /// Ticks the bus is busy for each line
+    int64_t transferTicks;
+
+    /// Tick the bus can be used for the next request
+    int64_t busFreeAt;
+
+    /// True while the write queue is being drained
+    bool draining;
+
+    /// True if an issue event is scheduled
+    bool issueScheduled;
+
+    int64_t reads;
+    int64_t writes;
+    int64_t rejected;
+    int64_t rowHitsFirst; // reads issued ahead of older reads
+    int64_t drains;
+    int64_t busyTicks;
+    int64_t readQueueTicks; // sum of the time reads spent queued
+    int64_t lastTick;
+
+    /**
+     * Make sure there is an issue event if there is anything to issue.
+     */
+    void scheduleIssue();
+
+    /**
+     * Issue the next request on the bus.
+     */
+    void issue();
+
+    /**
+     * @return the index of the request FR-FCFS picks from the queue
+     */
+    int pick(std::deque<Request> &queue);
+};
+
+#endif // CSIM_MEM_CTRL_H
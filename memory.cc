@@ -1,72 +1,240 @@
 
 #include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
 
-#include "cache.hh"
 #include "memory.hh"
 #include "util.hh"
 
-Memory::Memory(int line_size) :
-    memorySize(1<<26), // 64 MB
+Memory::Memory(int line_size, int addr_bits) :
+    addrBits(addr_bits),
     lineSize(line_size),
-    cacheWritebacks(0), cacheMisses(0)
+    lineBits(log2int(line_size)),
+    dataStorage(addr_bits, line_size, 1),
+    checker(new Checker(addr_bits, line_size, Checker::Sync, 1)),
+    channelBits(0), interleave(LineInterleave), retryPending(false),
+    beatBytes(0), cacheWritebacks(0), cacheMisses(0)
 {
+    channels.push_back({nullptr, nullptr, 0, 0});
 }
 
 Memory::~Memory()
 {
     std::cout << "Writebacks: " << cacheWritebacks << std::endl;
     std::cout << "Misses:     " << cacheMisses << std::endl;
-    for (auto it : dataStorage) {
-        assert(it.second.data);
-        delete[] it.second.data;
+    for (size_t i = 0; i < channels.size(); i++) {
+        Channel &channel = channels[i];
+        if (channels.size() > 1) {
+            int64_t total = cacheMisses + cacheWritebacks;
+            std::cout << "Channel " << i << ": reads " << channel.reads;
+            std::cout << " writes " << channel.writes;
+            if (total) {
+                std::cout << " share " <<
+                    (float)(channel.reads + channel.writes) / total;
+            }
+            std::cout << std::endl;
+        }
+        delete channel.controller;
+        delete channel.dram;
+    }
+    delete checker;
+}
+
+void
+Memory::setChannels(int channels, Interleave interleave)
+{
+    for (auto &channel : this->channels) {
+        // Timing models are per channel, so create them afterwards.
+        assert(!channel.dram && !channel.controller);
     }
+    channelBits = log2int(channels);
+    this->interleave = interleave;
+    this->channels.assign(channels, {nullptr, nullptr, 0, 0});
 }
 
 void
+Memory::setDRAM(const DRAMParams &params)
+{
+    for (auto &channel : channels) {
+        delete channel.dram;
+        channel.dram = new DRAM(params, lineSize);
+        if (channel.controller) channel.controller->setDRAM(channel.dram);
+    }
+}
+
+void
+Memory::setController(const MemCtrlParams &params)
+{
+    for (auto &channel : channels) {
+        delete channel.controller;
+        channel.controller = new MemoryController(params, lineSize,
+                                                  channel.dram);
+        channel.controller->setRetry([this]{
+            if (retryPending) {
+                retryPending = false;
+                cache->receiveRetry();
+            }
+        });
+    }
+}
+
+void
+Memory::setBurst(int beat_bytes)
+{
+    assert(beat_bytes > 0 && beat_bytes <= lineSize);
+    assert(__builtin_popcount(beat_bytes) == 1);
+    beatBytes = beat_bytes;
+}
+
+void
+Memory::setVerification(Checker::Mode mode, int sample_rate)
+{
+    delete checker;
+    checker = new Checker(addrBits, lineSize, mode, sample_rate);
+}
+
+int
+Memory::route(uint64_t address, uint64_t &local)
+{
+    int line_bits = getLineBits();
+    uint64_t mask = channels.size() - 1;
+
+    // Number of address bits below the channel bits.
+    int low_bits = line_bits;
+    if (interleave == PageInterleave && line_bits < 12) {
+        low_bits = 12;
+    }
+
+    uint64_t upper = address >> (low_bits + channelBits);
+    local = (upper << low_bits) | (address & ((1 << low_bits) - 1));
+
+    uint64_t channel = (address >> low_bits) & mask;
+    if (interleave == XorInterleave && channelBits > 0) {
+        // Fold all of the upper bits into the channel bits. The local
+        // address keeps the upper bits, so this is still one to one.
+        for (uint64_t bits = upper; bits; bits >>= channelBits) {
+            channel ^= bits & mask;
+        }
+    }
+    return channel;
+}
+
+bool
 Memory::receiveRequest(uint64_t address, int size, const uint8_t* data,
                        int request_id)
 {
+    return access(address, size, data, request_id, 0);
+}
+
+bool
+Memory::receiveFillRequest(uint64_t address, int request_id)
+{
+    uint64_t line_address = address & ~(uint64_t)(lineSize - 1);
+    return access(line_address, lineSize, nullptr, request_id,
+                  address - line_address);
+}
+
+bool
+Memory::access(uint64_t address, int size, const uint8_t* data,
+               int request_id, int critical)
+{
+    uint64_t local;
+    Channel &channel = channels[route(address, local)];
+    MemoryController *controller = channel.controller;
+    DRAM *dram = channel.dram;
+
+    if (controller && !controller->canAccept(data != nullptr)) {
+        DPRINT("Memory controller queue full");
+        retryPending = true;
+        return false;
+    }
+
     if (data) {
         // writing back data, so this is a writeback.
         cacheWritebacks++;
+        channel.writes++;
     } else {
         // Reading data, must be a cache miss.
         cacheMisses++;
+        channel.reads++;
     }
     // Immediately deal with the request.
 
-    // Only accept lineSize requests that are correctly aligned
-    assert(size == lineSize);
-    assert((address & (lineSize - 1)) == 0);
+    // Only accept lineSize requests that are correctly aligned. A cache
+    // that does not allocate on writes may also write part of a line.
+    assert(size == lineSize || (data && size < lineSize));
+    assert(__builtin_popcount(size) == 1);
+    assert((address & (size - 1)) == 0);
+    assert(fitsInBits(address, addrBits));
 
-    // get pointer from map.
-    auto it = dataStorage.find(address);
-    if (it == dataStorage.end()) {
-        uint8_t *new_data = new uint8_t[lineSize];
-        memset(new_data, 1, lineSize);
-        dataStorage[address] = {new_data, false};
+    // get pointer from the page table, allocating the page on first touch.
+    uint64_t line_address = address & ~(uint64_t)(lineSize - 1);
+    uint8_t* mem_data = dataStorage.getLine(line_address);
+
+    if (data && size < lineSize) {
+        // A partial write can be one of several pieces of a buffered line,
+        // so the line may not match until all of them are here. Reads of
+        // the line still check it.
+        memcpy(&mem_data[address - line_address], data, size);
+    } else if (data) {
+        // Make sure the data is correct, then write it. Only possible if no
+        // cache can have a newer copy.
+        if (cache->writebacksAreCurrent()) {
+            checker->checkWriteback(address, data);
+        }
+        memcpy(mem_data, data, lineSize);
     }
 
-    uint8_t* mem_data = dataStorage[address].data;
+    std::function<void(void)> respond = [this, request_id, mem_data]{
+        cache->receiveResponse(request_id, mem_data);
+    };
+    if (beatBytes && beatBytes < lineSize) {
+        respond = [this, request_id, mem_data, critical]{
+            sendBeats(request_id, mem_data, critical);
+        };
+    }
 
-    if (data) {
-        // Instead of writing the data, make sure the data is correct.
-        bool match = compareData(mem_data, data, lineSize);
-        if (!match) {
-            std::cout << "Address " << std::hex << address << std::endl;
-            std::cout << "ERROR! Writeback contains wrong data." << std::endl;
-            assert(0); // Assert for easier gdb
-        }
-        // Now that it's written back, it's no longer dirty in the cache
-        dataStorage[address].dirty = false;
-    } else {
+    if (controller) {
+        // The controller decides when the request is done. Writebacks get no
+        // response.
+        controller->enqueue(local, data != nullptr, respond);
+    } else if (dram) {
+        // Writebacks also keep the DRAM banks busy.
+        int64_t done = dram->access(local, data != nullptr, curTick());
+        if (!data) schedule(done - curTick(), respond);
+    } else if (!data) {
         // If reading schedule a request for later.
         // Wait for a "random" amount of time to reply
-        schedule(10+curTick() % 10,
-                [this, request_id, mem_data]{
-                    cache->receiveMemResponse(request_id, mem_data);
-                });
+        schedule(10+curTick() % 10, respond);
+    }
+
+    return true;
+}
+
+void
+Memory::sendBeats(int request_id, const uint8_t* mem_data, int critical)
+{
+    // Later writes to the line must not change the beats still to come.
+    auto line = std::make_shared<std::vector<uint8_t>>(mem_data,
+                                                       mem_data + lineSize);
+    int beats = lineSize / beatBytes;
+    int first = critical / beatBytes;
+    for (int i = 0; i < beats; i++) {
+        int offset = (first + i) % beats * beatBytes;
+        auto beat = [this, request_id, line, offset, i, beats]{
+            if (i == beats - 1) {
+                cache->receiveResponse(request_id, line->data());
+            } else {
+                cache->receiveBeat(request_id, offset,
+                                   line->data() + offset, beatBytes);
+            }
+        };
+        if (i == 0) {
+            beat();
+        } else {
+            schedule(i, beat);
+        }
     }
 }
 
@@ -79,60 +247,17 @@ Memory::getLineSize()
 int
 Memory::getLineBits()
 {
-    return log2int(lineSize);
+    return lineBits;
 }
 
 void
 Memory::processorWrite(uint64_t address, int size, const uint8_t* data)
 {
-    uint64_t line_address = address & ~(lineSize - 1);
-    auto it = dataStorage.find(line_address);
-
-    // We should always have backing data since processorWrite is called after
-    // the request completes.
-    assert(it != dataStorage.end());
-
-    int block_offset =  address & (lineSize - 1);
-
-    // Write the data to the backing store.
-    memcpy(it->second.data + block_offset, data, size);
-
-    // Mark that the cache contains dirty data
-    it->second.dirty = true;
+    checker->write(address, size, data);
 }
 
 void
 Memory::checkRead(uint64_t address, int size, const uint8_t* data)
 {
-    uint64_t line_address = address & ~(lineSize - 1);
-    auto it = dataStorage.find(line_address);
-
-    // We should always have backing data since processorWrite is called after
-    // the request completes.
-    assert(it != dataStorage.end());
-
-    int block_offset = address & (lineSize - 1);
-
-    bool match = compareData(it->second.data + block_offset, data, size);
-    if (!match) {
-        std::cout << "Address " << std::hex << address << std::endl;
-        std::cout << "ERROR! Read contains wrong data." << std::endl;
-        assert(0); // Assert for easier gdb
-    }
-}
-
-bool
-Memory::compareData(const uint8_t *correct, const uint8_t *compare, int num)
-{
-    bool match = true;
-    for (int i = 0; i < num; i++) {
-        if (correct[i] != compare[i]) {
-            std::cout << "Mismatch on byte " << i;
-            std::cout << " is " << std::hex << (uint32_t)compare[i];
-            std::cout << " should be " << std::hex << (uint32_t)correct[i];
-            std::cout << std::endl;
-            match = false;
-        }
-    }
-    return match;
+    checker->checkRead(address, size, data);
 }
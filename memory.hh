@@ -3,15 +3,34 @@
 #define CSIM_MEMORY_H
 
 #include <cstdint>
-#include <map>
+#include <vector>
 
-#include "cache.hh"
+#include "backing_store.hh"
+#include "checker.hh"
+#include "dram.hh"
+#include "mem_ctrl.hh"
+#include "port.hh"
 #include "ticked_object.hh"
 
-class Memory : public TickedObject
+class Memory : public TickedObject, public ResponsePort
 {
   public:
-    Memory(int line_size);
+    /**
+     * How addresses are spread over the channels
+     */
+    enum Interleave {
+        LineInterleave, // consecutive lines go to consecutive channels
+        PageInterleave, // consecutive 4 KB pages go to consecutive channels
+        XorInterleave   // line number bits XOR folded higher bits
+    };
+
+    /**
+     * @param line_size in bytes
+     * @param addr_bits is the number of bits in an address. The default is
+     *        64 MB of memory. Storage is sparse, so 48 or 64-bit address
+     *        spaces only cost what is touched.
+     */
+    Memory(int line_size, int addr_bits = 26);
     ~Memory();
 
     /**
@@ -20,27 +39,78 @@ class Memory : public TickedObject
      * request will be aligned to a 4 byte boundary)
      *
      * @param address of the request
-     * @param size in bytes of the request (should be line size).
+     * @param size in bytes of the request. Line size, or smaller for a
+     *        write from a cache that does not allocate on writes.
      * @param data is non-null, then this is a store request.
      * @param request_id the id that must be used when replying to this request
+     *
+     * @return true if the request was accepted, false if the memory
+     *         controller's queue is full. The cache's receiveMemRetry is
+     *         called once there is space again.
+     */
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    /**
+     * Read the line of address, in beats starting with the one that holds
+     * address if lines are sent in beats.
      */
-    void receiveRequest(uint64_t address, int size, const uint8_t* data,
-                        int request_id);
+    bool receiveFillRequest(uint64_t address, int request_id) override;
 
     /**
      * @return the line size in bytes
      */
-    int getLineSize();
+    int getLineSize() override;
 
     /**
      * @return the line size in bytes
      */
-    int getLineBits();
+    int getLineBits() override;
 
     /**
      * Connect the cache
      */
-    void setCache(Cache *cache) { this->cache = cache; }
+    void setRequestor(RequestPort *cache) override { this->cache = cache; }
+
+    /**
+     * Split memory into independent channels. Must be called before setDRAM
+     * and setController. By default there is a single channel.
+     *
+     * @param channels number of channels. Must be a power of two.
+     * @param interleave picks the channel for each address
+     */
+    void setChannels(int channels, Interleave interleave);
+
+    /**
+     * Use a DRAM timing model for the latency of requests instead of the
+     * default fixed latency. Every channel gets its own DRAM.
+     */
+    void setDRAM(const DRAMParams &params);
+
+    /**
+     * Put a memory controller with finite queues and bandwidth in front of
+     * the memory. Without it every request is accepted immediately. Every
+     * channel gets its own controller.
+     */
+    void setController(const MemCtrlParams &params);
+
+    /**
+     * Send lines in beats of beat_bytes, one beat per tick, instead of all
+     * at once. The first beat is sent when the whole line used to be.
+     * Lines read with receiveFillRequest start with the beat the cache
+     * asked for and wrap around, others start at the beginning of the line.
+     */
+    void setBurst(int beat_bytes);
+
+    /**
+     * Choose how the data the processor sees is verified. By default every
+     * read and writeback is checked synchronously.
+     *
+     * @param mode Sync, or Async to check on a separate thread
+     * @param sample_rate only check one in every sample_rate reads and
+     *        writebacks
+     */
+    void setVerification(Checker::Mode mode, int sample_rate);
 
     /**
      * DO NOT USE THESE FUNCTIONS! THESE ARE FOR TESTING PURPOSES ONLY
@@ -49,26 +119,63 @@ class Memory : public TickedObject
     void checkRead(uint64_t address, int size, const uint8_t* data);
 
   private:
-    Cache *cache;
+    RequestPort *cache;
 
-    int64_t memorySize;
+    int addrBits;
     int lineSize;
+    int lineBits;
+
+    /// The data in memory. Updated by writebacks and read by misses.
+    /// Cheat and only allocate the pages that are touched.
+    BackingStore dataStorage;
+
+    /// Holds the golden copy of the data the processor wrote
+    Checker *checker;
+
+    struct Channel {
+        /// Timing model. If nullptr every read takes 10-19 ticks.
+        DRAM *dram;
 
-    struct Block {
-        uint8_t *data;
-        bool dirty; // True if this data is dirty in the cache.
+        /// Queues requests in front of the DRAM. May be nullptr.
+        MemoryController *controller;
+
+        int64_t reads;
+        int64_t writes;
     };
 
-    /// Cheat and only allocate the blocks needed
-    std::map<uint64_t, Block> dataStorage;
+    std::vector<Channel> channels;
+    int channelBits;
+    Interleave interleave;
+
+    /// True if a request was rejected and the cache is waiting for a retry
+    bool retryPending;
+
+    /// Bytes sent each tick, or 0 to send whole lines
+    int beatBytes;
 
     int64_t cacheWritebacks;
     int64_t cacheMisses;
 
     /**
-     * Returns false if data does not match
+     * @return the channel for the address
+     * @param local is set to the address within the channel, which has the
+     *        channel bits removed
+     */
+    int route(uint64_t address, uint64_t &local);
+
+    /**
+     * Handle a request. Reads are sent back starting with the beat at
+     * critical in the line.
      */
-    bool compareData(const uint8_t *correct, const uint8_t *compare, int num);
+    bool access(uint64_t address, int size, const uint8_t* data,
+                int request_id, int critical);
+
+    /**
+     * Send the line at mem_data to the cache in beats, starting with the
+     * beat at critical.
+     */
+    void sendBeats(int request_id, const uint8_t* mem_data, int critical);
+
 };
 
 #endif // CSIM_MEMORY_H
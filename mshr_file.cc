@@ -0,0 +1,55 @@
+#include <cassert>
+
+#include "mshr_file.hh"
+
+MSHRFile::MSHRFile(int entries) :
+    entries(entries), index(entries), fills(0)
+{
+    assert(entries > 0);
+    // The lowest ids are handed out first.
+    for (int id = entries - 1; id >= 0; id--) {
+        this->entries[id] = {0, false, -1, false, {}, 0};
+        freeList.push_back(id);
+    }
+}
+
+int
+MSHRFile::allocate(uint64_t block_address, int target)
+{
+    assert(!isFull());
+    int id = freeList.back();
+    freeList.pop_back();
+
+    MSHR &entry = entries[id];
+    assert(!entry.issued);
+    entry.issued = true;
+    entry.blockAddr = block_address;
+    entry.target = target;
+    entry.prefetch = false;
+    entry.targets.clear();
+    entry.beats = 0;
+    index.insert(block_address, id);
+    if (target >= 0) fills++;
+    return id;
+}
+
+void
+MSHRFile::setTarget(int id, int target)
+{
+    MSHR &entry = entries[id];
+    assert(entry.issued);
+    if (entry.target >= 0) fills--;
+    entry.target = target;
+    if (target >= 0) fills++;
+}
+
+void
+MSHRFile::release(int id)
+{
+    MSHR &entry = entries[id];
+    assert(entry.issued);
+    entry.issued = false;
+    if (entry.target >= 0) fills--;
+    index.erase(entry.blockAddr);
+    freeList.push_back(id);
+}
@@ -0,0 +1,85 @@
+#ifndef CSIM_MSHR_FILE_H
+#define CSIM_MSHR_FILE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "tag_index.hh"
+
+/**
+ * The miss status holding registers of a non-blocking cache.
+ *
+ * An MSHR's id is its place in the file and the id of its memory request,
+ * so a response finds its MSHR directly. A hash index on the line address
+ * finds the MSHR of a line and a free list hands out unused ones, so no
+ * operation scans the file.
+ */
+class MSHRFile
+{
+  public:
+    /// A request waiting for a line
+    struct Target {
+        uint64_t address;
+        int size;
+        int id;
+        bool write;
+        std::vector<uint8_t> data; // the write data, or the read data
+    };
+
+    struct MSHR {
+        uint64_t blockAddr; // line address
+        bool issued;
+        int target; // line to fill, -1 to not keep the line. See setTarget
+        bool prefetch; // no demand access is waiting for the line
+        std::vector<Target> targets; // oldest first, empty for a prefetch
+        int beats; // beats of the line received so far
+    };
+
+    /**
+     * @param entries the number of MSHRs
+     */
+    MSHRFile(int entries);
+
+    MSHR& operator[](int id) { return entries[id]; }
+
+    /**
+     * @return the id of the MSHR fetching the line at block_address, or -1
+     */
+    int find(uint64_t block_address) {
+        return (int)index.find(block_address);
+    }
+
+    /**
+     * Take a free MSHR for the line at block_address, which must not have
+     * one already. It starts with no targets. The file must not be full.
+     *
+     * @param target line to fill, -1 if the line is not kept
+     * @return the id of the MSHR
+     */
+    int allocate(uint64_t block_address, int target);
+
+    /**
+     * Change the line the MSHR id fills.
+     */
+    void setTarget(int id, int target);
+
+    /**
+     * Free the MSHR id.
+     */
+    void release(int id);
+
+    int getEntries() { return entries.size(); }
+    int getFree() { return freeList.size(); }
+    bool isFull() { return freeList.empty(); }
+
+    /// The number of MSHRs in use that fill a line when they complete
+    int getFills() { return fills; }
+
+  private:
+    std::vector<MSHR> entries;
+    TagIndex index;
+    std::vector<int> freeList;
+    int fills;
+};
+
+#endif // CSIM_MSHR_FILE_H
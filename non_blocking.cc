@@ -6,102 +6,305 @@
 #include "processor.hh"
 #include "util.hh"
 
-NonBlockingCache::NonBlockingCache(int64_t size, Memory& memory,
+NonBlockingCache::NonBlockingCache(int64_t size, ResponsePort& memory,
                                    Processor& processor, int ways, int mshrs)
-: SetAssociativeCache(size, memory, processor, ways),
-numMshr(mshrs), stall(false)
+: SetAssociativeCache(size, memory, processor, ways,
+                      3), // valid, dirty and prefetched
+mshrFile(mshrs), maxTargets(0), stall(false), prefetcher(nullptr),
+issuingPrefetches(false), prefetchesIssued(0), prefetchesUseful(0),
+prefetchesLate(0), prefetchesUseless(0), secondaryMisses(0), targetStalls(0),
+earlyRestarts(0), earlyTicks(0)
 {
-    assert(mshrs > 0);
-    mshr = new MSHR[numMshr];
-    for (int i = 0; i < numMshr; i++) {
-        mshr[i] = {0, 0};
-    }
+    setTargetsPerMSHR(4);
 }
 
 NonBlockingCache::~NonBlockingCache()
 {
-    delete [] mshr;
+    std::cout << name << " secondary misses: " << secondaryMisses;
+    std::cout << " target stalls: " << targetStalls << std::endl;
+    if (earlyRestarts) {
+        std::cout << name << " early restarts: " << earlyRestarts;
+        std::cout << " ticks saved: " << earlyTicks << std::endl;
+    }
+    if (prefetcher) {
+        // Lines used before or after their fill, of all prefetched lines
+        // and of all lines that would have missed without prefetching.
+        int64_t used = prefetchesUseful + prefetchesLate;
+        std::cout << name << " prefetches: " << prefetchesIssued;
+        std::cout << " useful: " << prefetchesUseful;
+        std::cout << " late: " << prefetchesLate;
+        std::cout << " useless: " << prefetchesUseless << std::endl;
+        std::cout << name << " prefetch accuracy: "
+                  << (prefetchesIssued ? 100.0 * used / prefetchesIssued : 0)
+                  << "% coverage: "
+                  << (used ? 100.0 * used / (misses + prefetchesUseful) : 0)
+                  << "%" << std::endl;
+    }
+    delete prefetcher;
+}
+
+void
+NonBlockingCache::setTargetsPerMSHR(int targets)
+{
+    assert(targets > 0);
+    maxTargets = targets;
+    for (int id = 0; id < mshrFile.getEntries(); id++) {
+        assert(!mshrFile[id].issued);
+        mshrFile[id].targets.reserve(maxTargets);
+    }
+}
+
+void
+NonBlockingCache::setPrefetcher(Prefetcher::Type type, int degree)
+{
+    delete prefetcher;
+    prefetcher = Prefetcher::create(type, lineBits, degree);
+    prefetchQueue.clear();
+}
+
+namespace {
+
+// Builds a fixed cache for the geometry CommonGeometries picks
+template <ReplacementPolicy::Type Type>
+struct Builder
+{
+    typedef NonBlockingCache* Result;
+
+    template <class Geometry>
+    Result build() const
+    {
+        return new FixedCache<NonBlockingCache, Geometry, Type>(
+            size, memory, processor, ways, mshrs);
+    }
+
+    int64_t size;
+    ResponsePort &memory;
+    Processor &processor;
+    int ways;
+    int mshrs;
+};
+
+} // anonymous namespace
+
+NonBlockingCache*
+NonBlockingCache::create(int64_t size, ResponsePort& memory,
+                         Processor& processor, int ways, int mshrs,
+                         ReplacementPolicy::Type policy)
+{
+    int line_size = memory.getLineSize();
+    int64_t sets = size / line_size / ways;
+    NonBlockingCache *cache = nullptr;
+    if (policy == ReplacementPolicy::LRU) {
+        Builder<ReplacementPolicy::LRU> builder =
+            {size, memory, processor, ways, mshrs};
+        cache = CommonGeometries::build(builder, line_size, sets, ways);
+    } else if (policy == ReplacementPolicy::TreePLRU) {
+        Builder<ReplacementPolicy::TreePLRU> builder =
+            {size, memory, processor, ways, mshrs};
+        cache = CommonGeometries::build(builder, line_size, sets, ways);
+    }
+    if (!cache) {
+        cache = new NonBlockingCache(size, memory, processor, ways, mshrs);
+        cache->setReplacement(policy);
+    }
+    return cache;
 }
 
 bool
 NonBlockingCache::receiveRequest(uint64_t address, int size,
                                  const uint8_t* data, int request_id)
 {
-    assert(size <= memory.getLineSize()); // within line size
-    // within address range
-    assert(address < ((uint64_t)1 << processor.getAddrSize()));
-    assert((address & (size - 1)) == 0); // naturally aligned
+    return access(CacheGeometry(setIndex, lineSize, way), *replacement,
+                  address, size, data, request_id);
+}
 
-    if (stall) {
-        DPRINT("Cache is blocked!");
-        // Cache is currently blocked, so it cannot receive a new request
-        return false;
+template <class Geometry, class Policy>
+bool
+NonBlockingCache::access(const Geometry &geometry, Policy &policy,
+                         uint64_t address, int size, const uint8_t* data,
+                         int request_id)
+{
+    if (!startRequest(address, size, stall)) return false;
+
+    int set = (int) geometry.getSet(address);
+    uint64_t tag = geometry.getTag(address);
+    int linenum = lookup(geometry, address, set, tag); // get the hit linenum
+    if (linenum == NOTHIT) {
+        linenum = swapFromVictims(address);
+    }
+    if (linenum == NOTHIT && writebackBuffer) {
+        linenum = unpark(address);
     }
-    int set = (int) getSetIndex(address);
-    int linenum = hit(address); // get the hit linenum
-    int index= set * way + linenum;
+    int index = set * geometry.getWays() + linenum;
+    // writebacks from the cache above are not accesses a prefetcher can
+    // learn from
+    bool demand = !data || upper->needsWriteResponse();
 
     if (linenum != NOTHIT) { // hit
+        if (!writeThroughHit(address, size, data)) return false;
         DPRINT("Hit in cache");
+        hits++;
+        // A prefetched line is clean until its first use, so the exclusive
+        // dirty case below never rejects it.
+        bool prefetched = tagArray.getState(index) & prefetchedBit;
+        if (prefetched) {
+            prefetchesUseful++;
+        }
         // get a pointer to the data
         uint8_t* line = dataArray.getLine(index);
-        //cout << index << endl;
 
-        int block_offset = getBlockOffset(address);
+        int block_offset = geometry.getOffset(address);
 
+        // Update the state before responding, the response may cause a new
+        // request to this cache.
         if (data) {
             // if this is a write, copy the data into the cache.
             memcpy(&line[block_offset], data, size);
+            // Mark dirty, unless the write already went down
+            tagArray.setState(index,
+                              writePolicy == WriteThrough ? Clean : Dirty);
+            policy.touch(set, linenum);
+            if (demand) observeAccess(address, prefetched);
             sendResponse(request_id, nullptr);
-            // Mark dirty
-            int lru = tagArray.getState(index) >> 2;
-            int state = (lru << 2) | Dirty;
-            tagArray.setState(index, state);
+            if (writePolicy == WriteThrough) drainWrites();
+        } else if (inclusion == Exclusive) {
+            // The line moves to the level above. The data stays in the
+            // array until it is replaced, so it can still be sent.
+            if (dirty(address, linenum)) {
+                // The level above can change the line right away, so this
+                // writeback cannot wait in pendingWritebacks.
+                uint64_t wb_address = address & ~(lineSize - 1);
+                if (!pendingWritebacks.empty() ||
+                    !sendMemRequest(wb_address, lineSize, line,
+                                    -1)) {
+                    hits--;
+                    return rejectRequest();
+                }
+                writebacks++;
+            }
+            removeLine(index);
+            tagArray.setState(index, Invalid);
+            policy.invalidate(set, linenum);
+            observeAccess(address, prefetched);
+            sendResponse(request_id, &line[block_offset], size);
         } else {
             // This is a read so we need to return data
-            sendResponse(request_id, &line[block_offset]);
+            tagArray.setState(index, tagArray.getState(index) & statemask);
+            policy.touch(set, linenum);
+            observeAccess(address, prefetched);
+            sendResponse(request_id, &line[block_offset], size);
         }
-        setlru(address, linenum);
     }
     else
     {
-        linenum = findlru(address);
-        index = set * way + linenum;
+        linenum = policy.getVictim(set);
+        index = set * geometry.getWays() + linenum;
         DPRINT("Miss in cache " << (tagArray.getState(index) & statemask));
 
         // Forward to memory and block the cache.
         // need for req id since there are multiple outstanding request.
         // We need to read whether the request is a read or write.
-        uint64_t block_address = address & ~(memory.getLineSize() - 1);
-
+        uint64_t block_address = address - geometry.getOffset(address);
 
         /* deal with mshrs */
-        int mshrindex = 0;
-
-        mshrindex = searchMSHR(block_address);
-        if (mshrindex != numMshr) // found
-            stall = true;
-        else // not found
-        {
-            if (fullMSHR()) // full
+        int pending = mshrFile.find(block_address);
+        // Writes that would not allocate wait for the fill below, then hit.
+        bool allocate = !data || writePolicy == WriteBack;
+        if (pending >= 0 && mshrFile[pending].prefetch && demand &&
+            allocate) {
+            // A late prefetch. The demand access takes over its MSHR.
+            MSHR &entry = mshrFile[pending];
+            entry.prefetch = false;
+            mshrFile.setTarget(pending,
+                               (inclusion == Exclusive && !data) ? -1 : index);
+            addTarget(entry, address, size, data, request_id);
+            misses++;
+            prefetchesLate++;
+            observeAccess(address, true);
+            issuePrefetches();
+            return true;
+        }
+        if (pending >= 0) {
+            // Already waiting for this line. Wait with the requests before
+            // it, unless its MSHR is full or the line will not be kept.
+            MSHR &entry = mshrFile[pending];
+            if ((int)entry.targets.size() == maxTargets ||
+                (data && (entry.target < 0 || writePolicy != WriteBack))) {
+                // Retry when it is filled.
+                if ((int)entry.targets.size() == maxTargets) targetStalls++;
                 stall = true;
-            else
-            {
-                // only send mem request if not found block address in mshrs
-                sendMemRequest(block_address, memory.getLineSize(), nullptr, request_id);
-                mshrindex = findFreeMSHR();
-                mshr[mshrindex].issued = 1;
-                mshr[mshrindex].blockAddr = block_address;
-                mshr[mshrindex].savedAddr = address;
-                mshr[mshrindex].savedSize = size;
-                mshr[mshrindex].target = index;
-                mshr[mshrindex].savedId = request_id;
-                mshr[mshrindex].savedData = data;
+                return rejectRequest();
             }
+            // A writeback from above makes a prefetch a real fill.
+            entry.prefetch = false;
+            addTarget(entry, address, size, data, request_id);
+            misses++;
+            secondaryMisses++;
+            if (demand) observeAccess(address, true);
+            issuePrefetches();
+            return true;
         }
 
+        if (data && writePolicy != WriteBack) {
+            // Do not allocate, only send the write down. Dirty lines that
+            // were evicted go first.
+            if (!pendingWritebacks.empty() ||
+                !writeAround(address, size, data, request_id)) {
+                return rejectRequest();
+            }
+            if (demand) observeAccess(address, true);
+            issuePrefetches();
+            return true;
+        }
 
+        if (mshrFile.isFull()) {
+            // Out of MSHRs. Retry when a response frees one.
+            stall = true;
+            return rejectRequest();
+        }
+
+        if (!writebackSpace()) {
+            // Retry when the writeback buffer drains.
+            writebackStalls++;
+            return rejectRequest();
+        }
+
+        if (data && !upper->needsWriteResponse() &&
+            size == lineSize) {
+            // A writeback from the cache above is a full line, so it does
+            // not need the old data. Partial writes from a write through
+            // cache above are filled like stores.
+            misses++;
+            fillLine(index, address, data, Dirty, false);
+            sendResponse(request_id, nullptr);
+            return true;
+        }
+
+        if (!pendingWritebacks.empty() || !flushWrites(block_address)) {
+            // memory is full, the processor retries when it's not
+            DPRINT("Memory is full!");
+            return rejectRequest();
+        }
+
+        // Fill in the MSHR first, a cache below may respond right away.
+        // The MSHR index is the id of the memory request.
+        // exclusive caches only keep lines evicted from above
+        int mshrindex = mshrFile.allocate(block_address,
+            (inclusion == Exclusive && !data) ? -1 : index);
+        MSHR &entry = mshrFile[mshrindex];
+        addTarget(entry, address, size, data, request_id);
+
+        misses++;
+        if (!sendFillRequest(address, mshrindex)) {
+            // memory is full, the processor retries when it's not
+            DPRINT("Memory is full!");
+            misses--;
+            mshrFile.release(mshrindex);
+            return rejectRequest();
+        }
+        observeAccess(address, true);
     }
+    issuePrefetches();
     return true;
 }
 
@@ -109,122 +312,376 @@ void
 NonBlockingCache::receiveMemResponse(int request_id, const uint8_t* data)
 {
     assert(data);
+    assert(request_id >= 0 && request_id < mshrFile.getEntries());
+    assert(mshrFile[request_id].issued);
 
-    for (int i = 0; i < numMshr; i++)
-    {
-        if (mshr[i].issued)
-        {
-            if (mshr[i].savedId == request_id)
-            {
-                copyDataIntoCache(mshr[i], data);
-                mshr[i].issued = 0;
-                mshr[i].blockAddr = 0;
-                mshr[i].savedAddr = 0;
-                mshr[i].savedSize = -1;
-                mshr[i].target = 0;
-                mshr[i].savedId = 0;
-                mshr[i].savedData = nullptr;
-                break;
+    fillBuffer.assign(data, data + lineSize);
+    copyDataIntoCache(request_id, fillBuffer.data());
+
+    stall = false;
+    sendRetry();
+    issuePrefetches();
+}
+
+void
+NonBlockingCache::receiveBeat(int request_id, int offset, const uint8_t* data,
+                              int size)
+{
+    assert(request_id >= 0 && request_id < mshrFile.getEntries());
+    MSHR &mshr = mshrFile[request_id];
+    assert(mshr.issued);
+    // Beats come one per tick, so this is how long until the last one.
+    int64_t ticks_left = lineSize / size - 1 - mshr.beats;
+    mshr.beats++;
+
+    // Take the reads before the first write whose data is in this beat.
+    // Reads after a write have to see it, so they wait for the fill.
+    vector<Target> ready;
+    for (auto it = mshr.targets.begin();
+         it != mshr.targets.end() && !it->write;) {
+        int start = getBlockOffset(it->address) - offset;
+        if (start >= 0 && start + it->size <= size) {
+            it->data.assign(data + start, data + start + it->size);
+            ready.push_back(std::move(*it));
+            it = mshr.targets.erase(it);
+        } else {
+            ++it;
+        }
+    }
+
+    // Nothing is sent until the MSHR is done with: responding can cause
+    // new requests to this cache.
+    for (Target &target : ready) {
+        earlyRestarts++;
+        earlyTicks += ticks_left;
+        sendResponse(target.id, target.data.data(), target.size);
+    }
+}
+
+void
+NonBlockingCache::receiveMemRetry()
+{
+    if (writebackBuffer) writebackBuffer->retry();
+    while (!pendingWritebacks.empty()) {
+        Writeback &wb = pendingWritebacks.front();
+        if (!sendMemRequest(wb.address, lineSize, wb.data.data(),
+                            -1)) {
+            // still full, wait for the next retry
+            return;
+        }
+        pendingWritebacks.pop_front();
+    }
+
+    drainWrites();
+    sendRetry();
+    issuePrefetches();
+}
+
+void
+NonBlockingCache::setInclusion(Inclusion inclusion)
+{
+    this->inclusion = inclusion;
+}
+
+void
+NonBlockingCache::receiveEviction(uint64_t address, const uint8_t* data)
+{
+    // Already have it, or it is being fetched
+    if (hit(address) != NOTHIT || inVictims(address) ||
+        mshrFile.find(address) >= 0 ||
+        (writebackBuffer && writebackBuffer->find(address) >= 0)) {
+        return;
+    }
+    // The line is clean, dropping it is cheaper than waiting.
+    if (!writebackSpace()) return;
+
+    int set = getSetIndex(address);
+    int index = set * way + replacement->getVictim(set);
+    fillLine(index, address, data, Clean, false);
+}
+
+bool
+NonBlockingCache::receiveInvalidate(uint64_t address, uint8_t* data)
+{
+    int linenum = hit(address);
+    int entry = victims && linenum == NOTHIT ? victims->find(address) : -1;
+    if (linenum != NOTHIT &&
+        (tagArray.getState(getSetIndex(address) * way + linenum) &
+         prefetchedBit)) {
+        prefetchesUseless++;
+    } else if (entry >= 0 && victims->isPrefetched(entry)) {
+        prefetchesUseless++;
+    }
+    bool was_dirty = SetAssociativeCache::receiveInvalidate(address, data);
+
+    // A writeback that has not been sent is newer than the line below.
+    bool pending = false;
+    for (auto it = pendingWritebacks.begin(); it != pendingWritebacks.end();) {
+        if (it->address == address) {
+            // the last one is the newest
+            if (!was_dirty) {
+                memcpy(data, it->data.data(), lineSize);
             }
+            pending = true;
+            it = pendingWritebacks.erase(it);
+        } else {
+            ++it;
         }
     }
+    return was_dirty || pending;
+}
 
-    stall = false;
+void
+NonBlockingCache::copyDataIntoCache(int id, const uint8_t* data)
+{
+    // The MSHR can be reused as soon as it is released, which can happen
+    // while the line is filled.
+    MSHR &mshr = mshrFile[id];
+    uint64_t block_address = mshr.blockAddr;
+    int index = mshr.target;
+    bool prefetch = mshr.prefetch;
+    vector<Target> waiting;
+    waiting.swap(mshr.targets);
+    mshrFile.release(id);
+
+    // The fill takes a port of its bank, unless the line is only passed on.
+    if (index >= 0) fillBank(block_address);
+
+    if (prefetch) {
+        // Nobody is waiting, only keep the line.
+        fillLine(index, block_address, data, Clean | prefetchedBit, false);
+        return;
+    }
+
+    bool written = false;
+    for (Target &target : waiting) {
+        written = written || target.write;
+    }
+
+    // Evicting the old line can send requests below, so fill before
+    // anything else. Not kept in this cache if there is no target line,
+    // only passed on.
+    const uint8_t* line = data;
+    if (index >= 0) {
+        fillLine(index, block_address, data, written ? Dirty : Clean,
+                 true);
+        line = dataArray.getLine(index);
+    }
+
+    // Apply the requests in order. Each read takes the data as it was at
+    // its turn, and nothing is sent until all are done: responding can
+    // cause new requests to this cache.
+    for (Target &target : waiting) {
+        int block_offset = getBlockOffset(target.address);
+        if (target.write) {
+            assert(index >= 0);
+            memcpy(dataArray.getLine(index) + block_offset,
+                   target.data.data(), target.size);
+        } else {
+            target.data.assign(line + block_offset,
+                               line + block_offset + target.size);
+        }
+    }
+
+    for (Target &target : waiting) {
+        sendResponse(target.id, target.write ? nullptr : target.data.data(),
+                     target.size);
+    }
+
+    // Give the space back unless the MSHR was reused meanwhile.
+    if (!mshrFile[id].issued && mshrFile[id].targets.empty()) {
+        waiting.clear();
+        mshrFile[id].targets.swap(waiting);
+    }
 }
 
 void
-NonBlockingCache::copyDataIntoCache(MSHR mshr, const uint8_t* data)
+NonBlockingCache::addTarget(MSHR &mshr, uint64_t address, int size,
+                            const uint8_t* data, int request_id)
 {
-    // dirty
-    if (dirty(mshr.savedAddr, mshr.target - getSetIndex(mshr.savedAddr) * way))
-    {
-        DPRINT("Dirty, writing back");
-        // If the line is dirty, then we need to evict it.
-        uint8_t* line = dataArray.getLine(mshr.target);
-        // Calculate the address of the writeback.
-        uint64_t wb_address =
-        tagArray.getTag(mshr.target) << (processor.getAddrSize() - tagBits);
-        wb_address |= (getSetIndex(mshr.savedAddr) << memory.getLineBits());
-        // No response for writes, no need for valid request_id
-        sendMemRequest(wb_address, memory.getLineSize(), line, -1);
-    }
-    
-    // clean -> invalidate
-    int lru = tagArray.getState(mshr.target) >> 2;
-    int state = (lru << 2) | Invalid;
-    tagArray.setState(mshr.target, state);
-    setlru(mshr.savedAddr, mshr.target - getSetIndex(mshr.savedAddr) * way);
-    
+    assert((int)mshr.targets.size() < maxTargets);
+    mshr.targets.emplace_back();
+    Target &target = mshr.targets.back();
+    target.address = address;
+    target.size = size;
+    target.id = request_id;
+    target.write = data != nullptr;
+    if (data) {
+        target.data.assign(data, data + size);
+    }
+}
+
+void
+NonBlockingCache::fillLine(int index, uint64_t address, const uint8_t* data,
+                           int state, bool demand)
+{
+    int set = getSetIndex(address);
+    evictLine(index, set);
+
     // Set tag
-    tagArray.setTag(mshr.target, getTag(mshr.savedAddr));
-    
+    tagArray.setTag(index, getTag(address));
+
     // transit
-    lru = tagArray.getState(mshr.target) >> 2;
-    state = (lru << 2) | Transit;
-    tagArray.setState(mshr.target, state);
-    setlru(mshr.savedAddr, mshr.target - getSetIndex(mshr.savedAddr) * way);
+    tagArray.setState(index, Transit);
 
     // Copy the data into the cache.
-    uint8_t* line = dataArray.getLine(mshr.target);
-    memcpy(line, data, memory.getLineSize());
+    uint8_t* line = dataArray.getLine(index);
+    memcpy(line, data, lineSize);
+
+    tagArray.setState(index, state);
+    addLine(index);
+    replacement->insert(set, index - set * way, demand);
+}
 
-    // in transit at this point
-    assert((tagArray.getState(mshr.target) & statemask) == Transit);
+void
+NonBlockingCache::evictLine(int index, uint64_t set)
+{
+    int state = tagArray.getState(index) & statemask;
+    if (state == Invalid) return;
+    assert(state != Transit);
+    bool prefetched = tagArray.getState(index) & prefetchedBit;
 
-    // Treat as a hit
-    int block_offset = getBlockOffset(mshr.savedAddr);
+    uint8_t* line = dataArray.getLine(index);
+    // Calculate the address of the line.
+    uint64_t address = setIndex.getAddress(tagArray.getTag(index), set);
 
-    if (mshr.savedData) // if write
-    {
-        // if this is a write, copy the data into the cache.
-        memcpy(&line[block_offset], mshr.savedData, mshr.savedSize);
-        sendResponse(mshr.savedId, nullptr);
-        
-        // Mark dirty
-        lru = tagArray.getState(mshr.target) >> 2;
-        state = (lru << 2) | Dirty;
-        tagArray.setState(mshr.target, state);
-    }
-    else // if load
-    {
-        // This is a read so we need to return data
-        sendResponse(mshr.savedId, &line[block_offset]);
-        
-        // Mark Clean
-        lru = tagArray.getState(mshr.target) >> 2;
-        state = (lru << 2) | Clean;
-        tagArray.setState(mshr.target, state);
+    if (victims) {
+        // The victim cache is still part of this cache, only the line it
+        // gives up leaves.
+        int entry = victims->getVictim();
+        if (victims->isValid(entry)) {
+            if (victims->isDirty(entry)) victimWritebacks++;
+            if (victims->isPrefetched(entry)) prefetchesUseless++;
+            releaseLine(victims->getAddress(entry), victims->getLine(entry),
+                        victims->isDirty(entry));
+        }
+        // A prefetched line can still be used from there.
+        victims->fill(entry, address, line, state == Dirty, prefetched);
+    } else {
+        if (prefetched) prefetchesUseless++;
+        releaseLine(address, line, state == Dirty);
     }
 
+    // clean -> invalidate
+    removeLine(index);
+    tagArray.setState(index, Invalid);
 }
 
-int
-NonBlockingCache::findFreeMSHR()
+void
+NonBlockingCache::releaseLine(uint64_t address, uint8_t* line, bool is_dirty)
+{
+    // The levels above may have a newer copy.
+    if (inclusion == Inclusive && upper->receiveInvalidate(address, line)) {
+        is_dirty = true;
+    }
+
+    if (is_dirty) {
+        DPRINT("Dirty, writing back");
+        writeBack(address, line);
+    } else {
+        // Let an exclusive level below keep the clean line.
+        sendEviction(address, line);
+    }
+}
+
+void
+NonBlockingCache::writeBack(uint64_t address, const uint8_t* data)
 {
-    int index;
-    for (index = 0; index < numMshr; index++)
-        if (!mshr[index].issued)
+    writebacks++;
+    if (writebackBuffer && !writebackBuffer->isFull()) {
+        writebackBuffer->park(address, data);
+        return;
+    }
+    // No response for writes, no need for valid request_id
+    // If memory is full, keep a copy of the line until it has space.
+    if (!pendingWritebacks.empty() ||
+        !sendMemRequest(address, lineSize, data, -1)) {
+        pendingWritebacks.push_back(
+            {address, vector<uint8_t>(data, data + lineSize)});
+    }
+}
+
+void
+NonBlockingCache::observeAccess(uint64_t address, bool miss)
+{
+    if (!prefetcher) return;
+
+    suggestions.clear();
+    prefetcher->observe(address, miss, suggestions);
+    for (uint64_t block_address : suggestions) {
+        if (!fitsInBits(block_address, addrBits)) continue;
+        // The newest suggestions are the most timely, drop the oldest.
+        if ((int)prefetchQueue.size() == maxPrefetchQueue) {
+            prefetchQueue.pop_front();
+        }
+        prefetchQueue.push_back(block_address);
+    }
+}
+
+void
+NonBlockingCache::issuePrefetches()
+{
+    // A response to a prefetch can arrive while it is being sent.
+    if (issuingPrefetches) return;
+    issuingPrefetches = true;
+
+    // Demand misses go first: nothing is prefetched while one waits for an
+    // MSHR or for memory, and one MSHR is always left for them.
+    while (!prefetchQueue.empty() && !stall && pendingWritebacks.empty() &&
+           mshrFile.getFree() > 1 && writebackSpace()) {
+        uint64_t block_address = prefetchQueue.front();
+        prefetchQueue.pop_front();
+        if (hit(block_address) != NOTHIT || inVictims(block_address) ||
+            mshrFile.find(block_address) >= 0 ||
+            (writeQueue && writeQueue->find(block_address) >= 0) ||
+            (writebackBuffer && writebackBuffer->find(block_address) >= 0)) {
+            continue;
+        }
+
+        int set = getSetIndex(block_address);
+        int mshrindex = mshrFile.allocate(block_address,
+            set * way + replacement->getVictim(set));
+        mshrFile[mshrindex].prefetch = true;
+
+        prefetchesIssued++;
+        if (!sendMemRequest(block_address, lineSize, nullptr,
+                            mshrindex)) {
+            // Prefetches are only hints, drop it and try the rest later.
+            prefetchesIssued--;
+            mshrFile.release(mshrindex);
             break;
-    
-    return index;
+        }
+    }
+
+    issuingPrefetches = false;
 }
 
 int
-NonBlockingCache::searchMSHR(uint64_t blockAddr)
+NonBlockingCache::unpark(uint64_t address)
 {
-    int index;
-    for (index = 0; index < numMshr; index++)
-        if (mshr[index].issued && mshr[index].blockAddr == blockAddr)
-            break;
-    
-    return index;
+    int entry =
+        writebackBuffer->find(address & ~(lineSize - 1));
+    if (entry < 0) return NOTHIT;
+    writebackBuffer->hits++;
+
+    // The parked line leaves first, so its entry has room for the line it
+    // replaces.
+    parkedLine.assign(writebackBuffer->getLine(entry),
+                      writebackBuffer->getLine(entry) + lineSize);
+    writebackBuffer->remove(entry);
+
+    int set = getSetIndex(address);
+    int linenum = replacement->getVictim(set);
+    fillLine(set * way + linenum, address, parkedLine.data(), Dirty, false);
+    return linenum;
 }
 
 bool
-NonBlockingCache::fullMSHR()
+NonBlockingCache::writebackSpace()
 {
-    int index;
-    for (index = 0; index < numMshr && mshr[index].issued; index++);
+    if (!writebackBuffer) return true;
 
-    return index == numMshr;
+    // Each fill in flight may evict a dirty line when it arrives.
+    return writebackBuffer->getSize() + mshrFile.getFills() <
+           writebackBuffer->getEntries();
 }
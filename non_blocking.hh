@@ -1,6 +1,11 @@
 #ifndef CSIM_NON_BLOCKING_H
 #define CSIM_NON_BLOCKING_H
 
+#include <deque>
+#include <vector>
+
+#include "mshr_file.hh"
+#include "prefetcher.hh"
 #include "set_assoc.hh"
 #include "tag_array.hh"
 #include "sram_array.hh"
@@ -11,14 +16,25 @@ class NonBlockingCache: public SetAssociativeCache
 public:
     /**
      * @size is the *total* size of the cache in bytes
-     * @memory is below this cache
+     * @memory is below this cache, memory or another cache
      * @processor this cache is connected to
      * @ways the number of ways in this set associative cache. If the number
      *        of ways cannot be realized, this will cause an error
      * @mshrs number of MSHRs (or max number of concurrent outstanding requests)
      */
-    NonBlockingCache(int64_t size, Memory& memory, Processor& processor,
+    NonBlockingCache(int64_t size, ResponsePort& memory, Processor& processor,
                      int ways, int mshrs);
+
+    /**
+     * Same arguments as the constructor, plus the replacement policy.
+     * Common geometries with LRU or tree PLRU get a request path compiled
+     * for them (see cache_geometry.hh), others a plain cache. The caller
+     * owns the cache.
+     */
+    static NonBlockingCache* create(int64_t size, ResponsePort& memory,
+                                    Processor& processor, int ways, int mshrs,
+                                    ReplacementPolicy::Type policy =
+                                        ReplacementPolicy::LRU);
     
     /**
      * Destructor
@@ -50,31 +66,128 @@ public:
      *        NOTE: This pointer will be invalid when this function returns.
      */
     void receiveMemResponse(int request_id, const uint8_t* data) override;
-    
+
+    /**
+     * Called with each beat of a line memory sends in beats, but the last.
+     * Reads waiting for the line whose data is all in the beat are answered
+     * right away. The line is only filled by receiveMemResponse.
+     */
+    void receiveBeat(int request_id, int offset, const uint8_t* data,
+                     int size) override;
+
+    /**
+     * Called when memory has space again. Sends the writebacks memory
+     * rejected and then lets the processor retry.
+     */
+    void receiveMemRetry() override;
+
+    /**
+     * Inclusive: evicting a line removes it from the levels above.
+     * Exclusive: a line moves up on a hit and clean lines evicted above are
+     * kept here instead.
+     */
+    void setInclusion(Inclusion inclusion) override;
+
+    bool wantsCleanEvictions() override { return inclusion == Exclusive; }
+
+    /**
+     * Called with a clean line evicted by the level above. Exclusive only.
+     */
+    void receiveEviction(uint64_t address, const uint8_t* data) override;
+
+    /**
+     * Called by an inclusive cache below when it evicts a line.
+     */
+    bool receiveInvalidate(uint64_t address, uint8_t* data) override;
+
+    /**
+     * Prefetch with a prefetcher of type, degree lines at a time. Prefetches
+     * only use MSHRs that demand misses leave free, and always leave one.
+     * The destructor prints how many were useful, late and useless.
+     */
+    void setPrefetcher(Prefetcher::Type type, int degree = 2);
+
+    /**
+     * Let each MSHR hold up to targets requests for its line. Misses to a
+     * line that is already being fetched wait in its MSHR and are all
+     * handled in order when it is filled; the cache only stalls when the
+     * MSHR is full. The default is 4. Call before the simulation starts.
+     */
+    void setTargetsPerMSHR(int targets);
+
+protected:
+    /**
+     * The request path of receiveRequest, with the address math of
+     * geometry and policy calls on policy. Defined in non_blocking.cc.
+     */
+    template <class Geometry, class Policy>
+    bool access(const Geometry &geometry, Policy &policy, uint64_t address,
+                int size, const uint8_t* data, int request_id);
+
 private:
     enum State {
         Invalid=0,
-        Transit=1,
-        Clean=2,
+        Clean=1, // Must match SetAssociativeCache's Valid to hit
+        Transit=2,
         Dirty=3 // Dirty implies valid
     };
-    
-    struct MSHR {
-        uint64_t blockAddr; // line address
-        int issued;
-        uint64_t savedAddr;
-        int savedSize;
-        int savedId;
-        int target;
-        const uint8_t* savedData;
+
+    typedef MSHRFile::MSHR MSHR;
+    typedef MSHRFile::Target Target;
+    struct Writeback {
+        uint64_t address;
+        vector<uint8_t> data;
     };
-    MSHR* mshr;
-    int numMshr;
+    MSHRFile mshrFile;
+    int maxTargets; // requests one MSHR can hold
     bool stall;
-    void copyDataIntoCache(MSHR mshr, const uint8_t* data);
-    int searchMSHR(uint64_t blockAddr);
-    int findFreeMSHR();
-    bool fullMSHR();
+    // writebacks memory rejected, oldest first. No new misses are sent until
+    // these are gone so memory never sees a stale writeback.
+    deque<Writeback> pendingWritebacks;
+    // copy of the line being filled. The response data can be overwritten
+    // by a writeback sent to the cache below while evicting.
+    vector<uint8_t> fillBuffer;
+    // line moving out of the writeback buffer
+    vector<uint8_t> parkedLine;
+
+    Prefetcher *prefetcher; // nullptr to only fetch on demand
+    // line addresses to prefetch, oldest first
+    deque<uint64_t> prefetchQueue;
+    static const int maxPrefetchQueue = 16;
+    bool issuingPrefetches;
+    vector<uint64_t> suggestions;
+    int64_t prefetchesIssued;
+    int64_t prefetchesUseful; // hit by a demand access after the fill
+    int64_t prefetchesLate; // hit by a demand access before the fill
+    int64_t prefetchesUseless; // evicted or invalidated without being used
+    int64_t secondaryMisses; // misses added to an MSHR already in flight
+    int64_t targetStalls; // misses rejected because their MSHR was full
+    int64_t earlyRestarts; // reads answered before the last beat of a fill
+    int64_t earlyTicks; // ticks those reads were answered before it
+    // fill the line of MSHR id and answer the requests waiting for it
+    void copyDataIntoCache(int id, const uint8_t* data);
+    // queue a request on mshr
+    void addTarget(MSHR &mshr, uint64_t address, int size,
+                   const uint8_t* data, int request_id);
+    // put a line into index, evicting what was there. demand is true if it
+    // was fetched for a demand miss.
+    void fillLine(int index, uint64_t address, const uint8_t* data, int state,
+                  bool demand);
+    // remove the line at index, writing it back if needed
+    void evictLine(int index, uint64_t set);
+    // a line leaves this cache: take it from the levels above if inclusive
+    // and write it back or pass it on
+    void releaseLine(uint64_t address, uint8_t* line, bool is_dirty);
+    // send a dirty line below, or keep it until there is space
+    void writeBack(uint64_t address, const uint8_t* data);
+    int unpark(uint64_t address) override;
+    // true if the writeback buffer has room for the victims of every fill
+    // in flight and one more
+    bool writebackSpace();
+    // tell the prefetcher about a demand access and queue what it suggests
+    void observeAccess(uint64_t address, bool miss);
+    // send queued prefetches while there are spare MSHRs
+    void issuePrefetches();
 };
 
 #endif
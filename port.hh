@@ -0,0 +1,147 @@
+#ifndef CSIM_PORT_H
+#define CSIM_PORT_H
+
+#include <cstdint>
+
+/**
+ * The side of a connection that sends requests and gets responses back.
+ * The processor and the memory side of every cache are request ports.
+ */
+class RequestPort
+{
+  public:
+    virtual ~RequestPort() { }
+
+    /**
+     * Called when the level below finished a request.
+     *
+     * @param request_id is the id used when the request was sent
+     * @param data is the data for reads, nullptr for writes.
+     *        NOTE: This pointer will be invalid when this function returns.
+     */
+    virtual void receiveResponse(int request_id, const uint8_t* data) = 0;
+
+    /**
+     * Called when the level below can accept a request it rejected.
+     */
+    virtual void receiveRetry() = 0;
+
+    /**
+     * Called for each beat of a line the level below sends in beats,
+     * except the last. The last beat comes as receiveResponse with the
+     * whole line.
+     *
+     * @param request_id is the id used when the request was sent
+     * @param offset of the beat in the line
+     * @param data of the beat, size bytes
+     */
+    virtual void receiveBeat(int request_id, int offset, const uint8_t* data,
+                             int size) { }
+
+    /**
+     * Called by an inclusive level below when it evicts a line, so the line
+     * must be removed from this level too.
+     *
+     * @param address of the line
+     * @param data if the line is dirty here, its data is copied to data
+     *
+     * @return true if the line was dirty and data was copied
+     */
+    virtual bool receiveInvalidate(uint64_t address, uint8_t* data) {
+        return false;
+    }
+
+    /**
+     * @return true if writes need a response. Caches only send writebacks,
+     *         which get no response.
+     */
+    virtual bool needsWriteResponse() { return true; }
+
+    /**
+     * @return true if a writeback from the level below always has the
+     *         newest data, i.e., no level above can hold a newer dirty copy.
+     */
+    virtual bool writebacksAreCurrent() { return true; }
+
+    /**
+     * @return true if this level can write a dirty line back below and still
+     *         pass it up, so the copy below can become stale.
+     */
+    virtual bool leavesStaleCopies() { return false; }
+
+    /**
+     * @return true if this level or one above has taken a write but not
+     *         responded to it yet, so the data below is newer than what
+     *         the processor knows.
+     */
+    virtual bool writesInFlight() { return false; }
+};
+
+/**
+ * The side of a connection that receives requests and sends responses.
+ * Memory and the processor side of every cache are response ports.
+ */
+class ResponsePort
+{
+  public:
+    virtual ~ResponsePort() { }
+
+    /**
+     * Called when the level above sends a load or store request.
+     * All requests can be assummed to be naturally aligned (e.g., a 4 byte
+     * request will be aligned to a 4 byte boundary)
+     *
+     * @param address of the request
+     * @param size in bytes of the request.
+     * @param data is non-null, then this is a store request.
+     *        NOTE: data is invalid when this function returns. Data must be
+     *              copied.
+     * @param request_id the id that must be used when replying to this request
+     *
+     * @return true if the request can be received, false if this level is
+     *         blocked and the request must be retried later.
+     */
+    virtual bool receiveRequest(uint64_t address, int size,
+                                const uint8_t* data, int request_id) = 0;
+
+    /**
+     * Read the whole line that holds address. A level that sends lines in
+     * beats sends the beat with address first. By default this is a plain
+     * line read.
+     *
+     * @return the same as receiveRequest
+     */
+    virtual bool receiveFillRequest(uint64_t address, int request_id) {
+        uint64_t line_address = address & ~(uint64_t)(getLineSize() - 1);
+        return receiveRequest(line_address, getLineSize(), nullptr,
+                              request_id);
+    }
+
+    /**
+     * Called with a clean line the level above evicted. Only sent if
+     * wantsCleanEvictions is true. The line may be dropped.
+     */
+    virtual void receiveEviction(uint64_t address, const uint8_t* data) { }
+
+    /**
+     * @return true if clean lines evicted above should be sent here
+     */
+    virtual bool wantsCleanEvictions() { return false; }
+
+    /**
+     * Connect the level above
+     */
+    virtual void setRequestor(RequestPort *requestor) = 0;
+
+    /**
+     * @return the line size in bytes
+     */
+    virtual int getLineSize() = 0;
+
+    /**
+     * @return the number of bits of the block offset
+     */
+    virtual int getLineBits() = 0;
+};
+
+#endif // CSIM_PORT_H
@@ -0,0 +1,158 @@
+#include <cassert>
+#include <cstdlib>
+
+#include "prefetcher.hh"
+#include "util.hh"
+
+Prefetcher*
+Prefetcher::create(Type type, int line_bits, int degree)
+{
+    switch (type) {
+      case NextLine: return new NextLinePrefetcher(line_bits, degree);
+      case Stride: return new StridePrefetcher(line_bits, degree);
+      case Stream: return new StreamPrefetcher(line_bits, degree);
+    }
+    assert(0);
+    return nullptr;
+}
+
+Prefetcher::Prefetcher(int line_bits, int degree) :
+    lineBits(line_bits), degree(degree)
+{
+    assert(degree > 0);
+}
+
+Prefetcher::~Prefetcher()
+{
+
+}
+
+NextLinePrefetcher::NextLinePrefetcher(int line_bits, int degree) :
+    Prefetcher(line_bits, degree)
+{
+
+}
+
+void
+NextLinePrefetcher::observe(uint64_t address, bool miss,
+                            std::vector<uint64_t> &prefetches)
+{
+    if (!miss) return;
+
+    uint64_t line = address >> lineBits;
+    for (int i = 1; i <= degree; i++) {
+        // stop at the end of the address space
+        if (line + i < line) break;
+        prefetches.push_back((line + i) << lineBits);
+    }
+}
+
+StridePrefetcher::StridePrefetcher(int line_bits, int degree) :
+    Prefetcher(line_bits, degree), table(tableSize)
+{
+    for (Entry &entry : table) {
+        entry.valid = false;
+    }
+}
+
+void
+StridePrefetcher::observe(uint64_t address, bool miss,
+                          std::vector<uint64_t> &prefetches)
+{
+    uint64_t region = address >> regionBits;
+    Entry &entry = table[hashIndex(region) % tableSize];
+
+    if (!entry.valid || entry.region != region) {
+        entry = {region, address, 0, 0, true};
+        return;
+    }
+
+    int64_t stride = address - entry.lastAddr;
+    if (stride == 0) return; // same word again, tells us nothing
+    if (stride == entry.stride) {
+        if (entry.confidence < maxConfidence) entry.confidence++;
+    } else if (entry.confidence > 0) {
+        entry.confidence--;
+    } else {
+        entry.stride = stride;
+    }
+    entry.lastAddr = address;
+
+    // The stride was seen when it was set and again since.
+    if (entry.confidence == 0) return;
+
+    uint64_t line = address >> lineBits;
+    uint64_t next = address;
+    for (int i = 0; i < degree; i++) {
+        uint64_t prev = next;
+        next += stride;
+        // stop if the stride wraps around the address space
+        if ((stride > 0) != (next > prev)) break;
+        // small strides reach the same line more than once
+        if ((next >> lineBits) == line) continue;
+        line = next >> lineBits;
+        prefetches.push_back(line << lineBits);
+    }
+}
+
+StreamPrefetcher::StreamPrefetcher(int line_bits, int degree) :
+    Prefetcher(line_bits, degree), streams(numStreams), useCount(0)
+{
+    for (Stream &stream : streams) {
+        stream.valid = false;
+    }
+}
+
+void
+StreamPrefetcher::observe(uint64_t address, bool miss,
+                          std::vector<uint64_t> &prefetches)
+{
+    if (!miss) return;
+
+    uint64_t line = address >> lineBits;
+    useCount++;
+
+    // Find a stream this line continues, or replace the least recently used.
+    Stream *found = nullptr;
+    Stream *victim = &streams[0];
+    for (Stream &stream : streams) {
+        if (stream.valid) {
+            int64_t distance = line - stream.lastLine;
+            if (distance != 0 && llabs(distance) <= window &&
+                (stream.direction == 0 ||
+                 (distance > 0) == (stream.direction > 0))) {
+                found = &stream;
+                break;
+            }
+        }
+        if (!stream.valid ||
+            (victim->valid && stream.lastUse < victim->lastUse)) {
+            victim = &stream;
+        }
+    }
+
+    if (!found) {
+        *victim = {line, 0, 0, useCount, true};
+        return;
+    }
+
+    Stream &stream = *found;
+    int direction = line > stream.lastLine ? 1 : -1;
+    if (stream.direction == direction) {
+        if (stream.confidence < 2) stream.confidence++;
+    } else {
+        stream.direction = direction;
+        stream.confidence = 1;
+    }
+    stream.lastLine = line;
+    stream.lastUse = useCount;
+
+    if (stream.confidence < 2) return;
+
+    for (int i = 1; i <= degree; i++) {
+        uint64_t next = line + (int64_t)direction * i;
+        // stop at either end of the address space
+        if ((direction > 0) != (next > line)) break;
+        prefetches.push_back(next << lineBits);
+    }
+}
@@ -0,0 +1,121 @@
+#ifndef CSIM_PREFETCHER_H
+#define CSIM_PREFETCHER_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Predicts which lines will be needed soon from the accesses a cache sees.
+ *
+ * The cache tells the prefetcher about every demand access and whether it
+ * missed, and the prefetcher answers with line addresses to fetch. It never
+ * looks at the cache, so it may suggest lines that are already there; the
+ * cache drops those.
+ */
+class Prefetcher
+{
+  public:
+    enum Type {
+        NextLine,
+        Stride,
+        Stream
+    };
+
+    /**
+     * @param line_bits log2 of the line size
+     * @param degree the most lines to suggest for one access
+     * @return a new prefetcher of type. The caller owns it.
+     */
+    static Prefetcher* create(Type type, int line_bits, int degree);
+
+    virtual ~Prefetcher();
+
+    /**
+     * Called for every demand access.
+     *
+     * @param address of the access
+     * @param miss true if the access missed, or would have missed if the
+     *        line had not been prefetched
+     * @param prefetches line addresses to fetch are appended here
+     */
+    virtual void observe(uint64_t address, bool miss,
+                         std::vector<uint64_t> &prefetches) = 0;
+
+  protected:
+    Prefetcher(int line_bits, int degree);
+
+    int lineBits;
+    int degree;
+};
+
+/**
+ * Fetches the next degree lines after every miss.
+ */
+class NextLinePrefetcher : public Prefetcher
+{
+  public:
+    NextLinePrefetcher(int line_bits, int degree);
+
+    void observe(uint64_t address, bool miss,
+                 std::vector<uint64_t> &prefetches) override;
+};
+
+/**
+ * Finds a constant stride between the accesses to each region of memory.
+ * Once the same stride is seen twice in a row the next degree accesses of
+ * the region are fetched.
+ */
+class StridePrefetcher : public Prefetcher
+{
+  public:
+    StridePrefetcher(int line_bits, int degree);
+
+    void observe(uint64_t address, bool miss,
+                 std::vector<uint64_t> &prefetches) override;
+
+  private:
+    static const int regionBits = 12;
+    static const int tableSize = 64;
+    static const int maxConfidence = 3;
+
+    struct Entry {
+        uint64_t region;
+        uint64_t lastAddr;
+        int64_t stride;
+        int confidence;
+        bool valid;
+    };
+
+    std::vector<Entry> table;
+};
+
+/**
+ * Follows streams of misses to neighbouring lines. A stream is confirmed
+ * by two misses moving in the same direction within a window of lines,
+ * then every miss or prefetched line it reaches fetches degree lines ahead.
+ */
+class StreamPrefetcher : public Prefetcher
+{
+  public:
+    StreamPrefetcher(int line_bits, int degree);
+
+    void observe(uint64_t address, bool miss,
+                 std::vector<uint64_t> &prefetches) override;
+
+  private:
+    static const int numStreams = 16;
+    static const int window = 16; // in lines
+
+    struct Stream {
+        uint64_t lastLine; // line number, not address
+        int direction; // 1, -1 or 0 if not known yet
+        int confidence;
+        uint64_t lastUse;
+        bool valid;
+    };
+
+    std::vector<Stream> streams;
+    uint64_t useCount;
+};
+
+#endif // CSIM_PREFETCHER_H
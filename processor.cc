@@ -9,7 +9,9 @@
 
 Processor::Processor(int addrSize) : addressSize(addrSize), cache(nullptr), memory(nullptr), records(nullptr),
     blocked(false), totalRequests(0)
-{}
+{
+    assert(addressSize > 0 && addressSize <= 64);
+}
 
 Processor::~Processor()
 {
@@ -63,6 +65,19 @@ Processor::receiveResponse(int request_id, const uint8_t* data)
     checkData(*it->second, data);
     outstanding.erase(it);
 
+    unblock();
+}
+
+void
+Processor::receiveRetry()
+{
+    DPRINT("Got retry from cache");
+    unblock();
+}
+
+void
+Processor::unblock()
+{
     if (blocked) {
         // unblock now.
         DPRINT("Unblocking processor at " << curTick());
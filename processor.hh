@@ -12,7 +12,9 @@
 #include "ticked_object.hh"
 #include "record_store.hh"
 
-class Processor: public TickedObject
+class Memory;
+
+class Processor: public TickedObject, public RequestPort
 {
   protected:
     int addressSize;
@@ -28,6 +30,11 @@ class Processor: public TickedObject
 
     void sendRequest(Record &r);
 
+    /**
+     * If blocked, schedule the request the cache rejected again.
+     */
+    void unblock();
+
     bool blocked;
 
     virtual void createRecords();
@@ -51,10 +58,15 @@ class Processor: public TickedObject
      * @param the original request id
      * @param the data returned if it was a read (nullptr if write)
      */
-    void receiveResponse(int request_id, const uint8_t* data);
+    void receiveResponse(int request_id, const uint8_t* data) override;
+
+    /**
+     * Called by the cache when it can accept a request it rejected.
+     */
+    void receiveRetry() override;
 
     /**
-     * Connect the cache
+     * Connect the cache. The last cache connected is the one requests go to.
      */
     void setCache(Cache *cache) { this->cache = cache; }
 
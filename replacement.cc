@@ -0,0 +1,380 @@
+#include <cassert>
+
+#include "replacement.hh"
+#include "util.hh"
+
+/**
+ * @return the number of bits needed to tell ways ways apart
+ */
+static int wayBits(int ways)
+{
+    return ways > 1 ? 64 - __builtin_clzll(ways - 1) : 0;
+}
+
+ReplacementPolicy*
+ReplacementPolicy::create(Type type, int64_t sets, int ways)
+{
+    switch (type) {
+      case LRU: return new LRUPolicy(sets, ways);
+      case TreePLRU: return new TreePLRUPolicy(sets, ways);
+      case NRU: return new NRUPolicy(sets, ways);
+      case SRRIP: return new RRIPPolicy(sets, ways, false);
+      case BRRIP: return new RRIPPolicy(sets, ways, true);
+      case FIFO: return new FIFOPolicy(sets, ways);
+      case Random: return new RandomPolicy(sets, ways);
+      case DIP: return new DIPPolicy(sets, ways);
+    }
+    assert(0);
+    return nullptr;
+}
+
+ReplacementPolicy::ReplacementPolicy(int64_t sets, int ways, int64_t bits) :
+    sets(sets), ways(ways), bits(bits)
+{
+    assert(sets > 0);
+    assert(ways > 0);
+    totalSize += getSize();
+}
+
+ReplacementPolicy::~ReplacementPolicy()
+{
+
+}
+
+int64_t
+ReplacementPolicy::getTotalSize()
+{
+    return totalSize;
+}
+
+int64_t ReplacementPolicy::totalSize = 0;
+
+LRUPolicy::LRUPolicy(int64_t sets, int ways, int64_t extra_bits) :
+    ReplacementPolicy(sets, ways, sets * ways * wayBits(ways) + extra_bits),
+    prev(sets * ways), next(sets * ways), head(sets), tail(sets)
+{
+    // Start with way 0 as the least recently used and the last way as the
+    // most recently used.
+    for (int64_t set = 0; set < sets; set++) {
+        for (int way = 0; way < ways; way++) {
+            next[set * ways + way] = way - 1;
+            prev[set * ways + way] = way + 1 < ways ? way + 1 : -1;
+        }
+        head[set] = ways - 1;
+        tail[set] = 0;
+    }
+}
+
+void
+LRUPolicy::touch(int64_t set, int way)
+{
+    moveToHead(set, way);
+}
+
+void
+LRUPolicy::invalidate(int64_t set, int way)
+{
+    moveToTail(set, way);
+}
+
+int
+LRUPolicy::getVictim(int64_t set)
+{
+    return tail[set];
+}
+
+void
+LRUPolicy::unlink(int64_t set, int way)
+{
+    int64_t base = set * ways;
+    int p = prev[base + way];
+    int n = next[base + way];
+    if (p >= 0) next[base + p] = n; else head[set] = n;
+    if (n >= 0) prev[base + n] = p; else tail[set] = p;
+}
+
+void
+LRUPolicy::moveToHead(int64_t set, int way)
+{
+    if (head[set] == way) return;
+    unlink(set, way);
+
+    int64_t base = set * ways;
+    prev[base + way] = -1;
+    next[base + way] = head[set];
+    if (head[set] >= 0) prev[base + head[set]] = way; else tail[set] = way;
+    head[set] = way;
+}
+
+void
+LRUPolicy::moveToTail(int64_t set, int way)
+{
+    if (tail[set] == way) return;
+    unlink(set, way);
+
+    int64_t base = set * ways;
+    next[base + way] = -1;
+    prev[base + way] = tail[set];
+    if (tail[set] >= 0) next[base + tail[set]] = way; else head[set] = way;
+    tail[set] = way;
+}
+
+TreePLRUPolicy::TreePLRUPolicy(int64_t sets, int ways) :
+    ReplacementPolicy(sets, ways, sets * (ways - 1)),
+    levels(0), leaves(1)
+{
+    while (leaves < ways) {
+        leaves *= 2;
+        levels++;
+    }
+    nodes.resize(sets * leaves, 0);
+}
+
+void
+TreePLRUPolicy::point(int64_t set, int way, bool towards)
+{
+    uint8_t *tree = &nodes[set * leaves];
+    // Leaves are numbered leaves to 2 * leaves - 1, the parent of i is i / 2.
+    for (int node = way + leaves; node > 1; node /= 2) {
+        bool right = node & 1;
+        tree[node / 2] = towards ? right : !right;
+    }
+}
+
+void
+TreePLRUPolicy::touch(int64_t set, int way)
+{
+    point(set, way, false);
+}
+
+void
+TreePLRUPolicy::invalidate(int64_t set, int way)
+{
+    point(set, way, true);
+}
+
+int
+TreePLRUPolicy::getVictim(int64_t set)
+{
+    uint8_t *tree = &nodes[set * leaves];
+    int node = 1;
+    for (int i = 0; i < levels; i++) {
+        int child = node * 2 + tree[node];
+        // A right half that starts past the last way holds no ways.
+        if ((child << (levels - i - 1)) - leaves >= ways) {
+            child = node * 2;
+        }
+        node = child;
+    }
+    return node - leaves;
+}
+
+WayMasks::WayMasks(int64_t sets, int ways, int planes) :
+    wordsPerSet((ways + 63) / 64), planes(planes),
+    masks(sets * planes * wordsPerSet, 0)
+{
+
+}
+
+void
+WayMasks::set(int64_t set, int plane, int way, bool value)
+{
+    uint64_t bit = (uint64_t)1 << (way & 63);
+    if (value) {
+        words(set, plane)[way / 64] |= bit;
+    } else {
+        words(set, plane)[way / 64] &= ~bit;
+    }
+}
+
+int
+WayMasks::findFirst(int64_t set, int plane)
+{
+    uint64_t *mask = words(set, plane);
+    for (int i = 0; i < wordsPerSet; i++) {
+        if (mask[i]) return i * 64 + __builtin_ctzll(mask[i]);
+    }
+    return -1;
+}
+
+NRUPolicy::NRUPolicy(int64_t sets, int ways) :
+    ReplacementPolicy(sets, ways, sets * ways),
+    notUsed(sets, ways, 1)
+{
+    for (int64_t set = 0; set < sets; set++) {
+        for (int way = 0; way < ways; way++) {
+            notUsed.set(set, 0, way, true);
+        }
+    }
+}
+
+void
+NRUPolicy::touch(int64_t set, int way)
+{
+    notUsed.set(set, 0, way, false);
+    if (notUsed.findFirst(set, 0) < 0) {
+        // Everything was used, start a new period with only this way used.
+        for (int i = 0; i < ways; i++) {
+            notUsed.set(set, 0, i, i != way);
+        }
+    }
+}
+
+void
+NRUPolicy::invalidate(int64_t set, int way)
+{
+    notUsed.set(set, 0, way, true);
+}
+
+int
+NRUPolicy::getVictim(int64_t set)
+{
+    int way = notUsed.findFirst(set, 0);
+    // Only possible with one way
+    return way < 0 ? 0 : way;
+}
+
+RRIPPolicy::RRIPPolicy(int64_t sets, int ways, bool bimodal) :
+    ReplacementPolicy(sets, ways, sets * ways * 2),
+    bimodal(bimodal), inserts(0), rrpv(sets, ways, maxRRPV + 1)
+{
+    for (int64_t set = 0; set < sets; set++) {
+        for (int way = 0; way < ways; way++) {
+            rrpv.set(set, maxRRPV, way, true);
+        }
+    }
+}
+
+void
+RRIPPolicy::setRRPV(int64_t set, int way, int value)
+{
+    for (int i = 0; i <= maxRRPV; i++) {
+        rrpv.set(set, i, way, i == value);
+    }
+}
+
+void
+RRIPPolicy::touch(int64_t set, int way)
+{
+    // Hit priority: a hit line is predicted to be used again soon.
+    setRRPV(set, way, 0);
+}
+
+void
+RRIPPolicy::insert(int64_t set, int way, bool demand)
+{
+    // The set is only aged when a line is really replaced, so asking for a
+    // victim twice does not age it twice.
+    age(set);
+    if (bimodal && ++inserts % 32 != 0) {
+        setRRPV(set, way, maxRRPV);
+    } else {
+        setRRPV(set, way, maxRRPV - 1);
+    }
+}
+
+void
+RRIPPolicy::invalidate(int64_t set, int way)
+{
+    setRRPV(set, way, maxRRPV);
+}
+
+void
+RRIPPolicy::age(int64_t set)
+{
+    int value = maxRRPV;
+    while (rrpv.findFirst(set, value) < 0) {
+        value--;
+        assert(value >= 0);
+    }
+
+    // Age every line as if they were all incremented until the oldest
+    // reached the maximum. This moves whole planes instead of lines.
+    for (int age = value; age < maxRRPV; age++) {
+        for (int w = 0; w < rrpv.wordsPerSet; w++) {
+            rrpv.words(set, maxRRPV)[w] |= rrpv.words(set, maxRRPV - 1)[w];
+            for (int i = maxRRPV - 1; i > 0; i--) {
+                rrpv.words(set, i)[w] = rrpv.words(set, i - 1)[w];
+            }
+            rrpv.words(set, 0)[w] = 0;
+        }
+    }
+}
+
+int
+RRIPPolicy::getVictim(int64_t set)
+{
+    // The first of the oldest lines, it is the first to reach the maximum
+    // when the set is aged.
+    for (int value = maxRRPV; value >= 0; value--) {
+        int way = rrpv.findFirst(set, value);
+        if (way >= 0) return way;
+    }
+    assert(0);
+    return 0;
+}
+
+FIFOPolicy::FIFOPolicy(int64_t sets, int ways) :
+    ReplacementPolicy(sets, ways, sets * wayBits(ways)),
+    oldest(sets, 0)
+{
+
+}
+
+void
+FIFOPolicy::insert(int64_t set, int way, bool demand)
+{
+    if (way == oldest[set]) {
+        oldest[set] = (oldest[set] + 1) % ways;
+    }
+}
+
+int
+FIFOPolicy::getVictim(int64_t set)
+{
+    return oldest[set];
+}
+
+RandomPolicy::RandomPolicy(int64_t sets, int ways) :
+    ReplacementPolicy(sets, ways, 0), count(0)
+{
+
+}
+
+int
+RandomPolicy::getVictim(int64_t set)
+{
+    return hashIndex(count) % ways;
+}
+
+DIPPolicy::DIPPolicy(int64_t sets, int ways) :
+    LRUPolicy(sets, ways, pselBits),
+    psel(1 << (pselBits - 1)), inserts(0)
+{
+
+}
+
+void
+DIPPolicy::insert(int64_t set, int way, bool demand)
+{
+    // Leader sets train the counter towards the policy that misses less.
+    // Only demand misses count, prefetches and lines from other levels are
+    // not misses of the policy.
+    bool bimodal;
+    int leader = set % leaderSpacing;
+    if (leader == 0) {
+        bimodal = false;
+        if (demand && psel < (1 << pselBits) - 1) psel++;
+    } else if (leader == 1) {
+        bimodal = true;
+        if (demand && psel > 0) psel--;
+    } else {
+        bimodal = psel > (1 << (pselBits - 1));
+    }
+
+    if (bimodal && ++inserts % 32 != 0) {
+        moveToTail(set, way);
+    } else {
+        moveToHead(set, way);
+    }
+}
@@ -0,0 +1,273 @@
+#ifndef CSIM_REPLACEMENT_H
+#define CSIM_REPLACEMENT_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Chooses which way of a set to replace.
+ *
+ * The cache tells the policy when a line is hit (touch), filled (insert) or
+ * invalidated, and asks it for a victim on a miss. Asking does not change
+ * the policy, the set is only updated when a line is inserted. Each policy
+ * keeps only the per-set metadata it needs, so no call has to look at
+ * every way.
+ */
+class ReplacementPolicy
+{
+  public:
+    enum Type {
+        LRU,
+        TreePLRU,
+        NRU,
+        SRRIP,
+        BRRIP,
+        FIFO,
+        Random,
+        DIP
+    };
+
+    /**
+     * @return a new policy of type for a cache with sets sets of ways ways.
+     *         The caller owns it.
+     */
+    static ReplacementPolicy* create(Type type, int64_t sets, int ways);
+
+    virtual ~ReplacementPolicy();
+
+    /**
+     * The line in way of set was hit.
+     */
+    virtual void touch(int64_t set, int way) = 0;
+
+    /**
+     * A new line was put in way of set.
+     *
+     * @param demand true if the line was fetched for a demand miss, false
+     *        for prefetches, lines evicted from the level above and lines
+     *        taken back from a buffer
+     */
+    virtual void insert(int64_t set, int way, bool demand)
+    {
+        touch(set, way);
+    }
+
+    /**
+     * The line in way of set was invalidated. By default it is not moved.
+     */
+    virtual void invalidate(int64_t set, int way) { }
+
+    /**
+     * @return the way of set to replace next. Calling it again without an
+     *         insert in between gives the same way.
+     */
+    virtual int getVictim(int64_t set) = 0;
+
+    /**
+     * Return the size in bytes of the metadata real hardware would need.
+     */
+    int64_t getSize() { return bits / 8; }
+
+    /**
+     * Returns the total size of all replacement metadata.
+     */
+    static int64_t getTotalSize();
+
+  protected:
+    /**
+     * @param bits of metadata, for the size statistics
+     */
+    ReplacementPolicy(int64_t sets, int ways, int64_t bits);
+
+    int64_t sets;
+    int ways;
+    int64_t bits;
+
+    /// Sum of the size of all replacement metadata.
+    static int64_t totalSize;
+};
+
+/**
+ * True LRU. Each set is a doubly linked list of its ways from most to least
+ * recently used, so every operation is O(1).
+ */
+class LRUPolicy : public ReplacementPolicy
+{
+  public:
+    LRUPolicy(int64_t sets, int ways, int64_t extra_bits = 0);
+
+    // final, so a cache that knows its policy calls these directly
+    void touch(int64_t set, int way) override final;
+    void invalidate(int64_t set, int way) override final;
+    int getVictim(int64_t set) override final;
+
+  protected:
+    /// Move way to the most recently used end of the list
+    void moveToHead(int64_t set, int way);
+    /// Move way to the least recently used end of the list
+    void moveToTail(int64_t set, int way);
+    void unlink(int64_t set, int way);
+
+    /// Neighbours of each line in its set's list, -1 at the ends
+    std::vector<int> prev;
+    std::vector<int> next;
+    /// Most and least recently used way of each set
+    std::vector<int> head;
+    std::vector<int> tail;
+};
+
+/**
+ * Tree pseudo-LRU. ways - 1 bits per set, O(log ways) per access.
+ * Other way counts use the tree of the next power of two and never pick
+ * the leaves past the last way.
+ */
+class TreePLRUPolicy final : public ReplacementPolicy
+{
+  public:
+    TreePLRUPolicy(int64_t sets, int ways);
+
+    void touch(int64_t set, int way) override;
+    void invalidate(int64_t set, int way) override;
+    int getVictim(int64_t set) override;
+
+  private:
+    /// Point every node on the path to way towards (or away from) it
+    void point(int64_t set, int way, bool towards);
+
+    int levels;
+    /// ways rounded up to a power of two
+    int leaves;
+    /// Node i of set s is nodes[s * leaves + i], i from 1 to leaves - 1. A
+    /// node is 1 if the victim is in its right half.
+    std::vector<uint8_t> nodes;
+};
+
+/**
+ * Bit mask helpers for policies that keep one bit per way.
+ */
+class WayMasks
+{
+  public:
+    WayMasks(int64_t sets, int ways, int planes);
+
+    void set(int64_t set, int plane, int way, bool value);
+
+    /// @return the first way with its bit set in plane, or -1
+    int findFirst(int64_t set, int plane);
+
+    /// @return a pointer to the words of plane for set
+    uint64_t* words(int64_t set, int plane) {
+        return &masks[(set * planes + plane) * wordsPerSet];
+    }
+
+    int wordsPerSet;
+
+  private:
+    int planes;
+    std::vector<uint64_t> masks;
+};
+
+/**
+ * Not recently used. One bit per line, the victim is the first way that was
+ * not used since the last time all ways were used.
+ */
+class NRUPolicy : public ReplacementPolicy
+{
+  public:
+    NRUPolicy(int64_t sets, int ways);
+
+    void touch(int64_t set, int way) override;
+    void invalidate(int64_t set, int way) override;
+    int getVictim(int64_t set) override;
+
+  private:
+    /// bit set means the line was *not* used recently
+    WayMasks notUsed;
+};
+
+/**
+ * Static and bimodal re-reference interval prediction, 2 bits per line.
+ * SRRIP inserts lines with a long re-reference interval. BRRIP inserts
+ * them with a distant one, except for 1 in 32.
+ */
+class RRIPPolicy : public ReplacementPolicy
+{
+  public:
+    RRIPPolicy(int64_t sets, int ways, bool bimodal);
+
+    void touch(int64_t set, int way) override;
+    void insert(int64_t set, int way, bool demand) override;
+    void invalidate(int64_t set, int way) override;
+    int getVictim(int64_t set) override;
+
+  private:
+    static const int maxRRPV = 3;
+
+    void setRRPV(int64_t set, int way, int rrpv);
+
+    /// Increment every line until one reaches maxRRPV
+    void age(int64_t set);
+
+    bool bimodal;
+    uint64_t inserts;
+    /// One plane per value. A way's bit is set in the plane of its value.
+    WayMasks rrpv;
+};
+
+/**
+ * First in first out. A pointer per set to the oldest way.
+ */
+class FIFOPolicy : public ReplacementPolicy
+{
+  public:
+    FIFOPolicy(int64_t sets, int ways);
+
+    void touch(int64_t set, int way) override { }
+    void insert(int64_t set, int way, bool demand) override;
+    int getVictim(int64_t set) override;
+
+  private:
+    std::vector<int> oldest;
+};
+
+/**
+ * Random replacement. No metadata. The victim only changes when a line is
+ * inserted.
+ */
+class RandomPolicy : public ReplacementPolicy
+{
+  public:
+    RandomPolicy(int64_t sets, int ways);
+
+    void touch(int64_t set, int way) override { }
+    void insert(int64_t set, int way, bool demand) override { count++; }
+    int getVictim(int64_t set) override;
+
+  private:
+    uint64_t count;
+};
+
+/**
+ * Dynamic insertion policy. A few leader sets always use LRU insertion and a
+ * few always use bimodal insertion (insert at the LRU end, except for 1 in
+ * 32). A saturating counter of their demand misses decides what the other
+ * sets do.
+ */
+class DIPPolicy : public LRUPolicy
+{
+  public:
+    DIPPolicy(int64_t sets, int ways);
+
+    void insert(int64_t set, int way, bool demand) override;
+
+  private:
+    static const int pselBits = 10;
+
+    /// One set in every leaderSpacing leads for each policy
+    static const int leaderSpacing = 32;
+
+    int psel;
+    uint64_t inserts;
+};
+
+#endif // CSIM_REPLACEMENT_H
@@ -0,0 +1,344 @@
+#include <cassert>
+#include <cstring>
+#include <iostream>
+
+#include "sectored.hh"
+#include "memory.hh"
+#include "processor.hh"
+#include "util.hh"
+
+SectoredCache::SectoredCache(int64_t size, ResponsePort& memory,
+                             Processor& processor, int ways, int sectors) :
+    Cache(size, memory, processor), ways(ways),
+    sets(size / lineSize / sectors / ways),
+    sectors(sectors), sectorBits(log2int(sectors)),
+    setIndex(size / lineSize / sectors / ways, lineBits + sectorBits),
+    tagBits(setIndex.getTagBits(addrBits)),
+    replacement(ReplacementPolicy::create(ReplacementPolicy::LRU,
+                    size / lineSize / sectors / ways, ways)),
+    tagArray(size / lineSize / sectors, // Blocks
+             2 * sectors, // valid and dirty for each sector
+             tagBits, ways,
+             (1u << sectors) - 1), // valid if any sector is
+    dataArray(size / lineSize, lineSize),
+    blocked(false), mshr({-1, 0, 0, 0, nullptr, false}),
+    blockMisses(0), sectorMisses(0)
+{
+    assert(ways > 0);
+    assert(sectors > 0 && sectors <= 16);
+    assert(sets > 0);
+    assert(sets * ways * sectors * lineSize == size);
+}
+
+SectoredCache::~SectoredCache()
+{
+    // A cache of the same size without sectors has sectors times the sets,
+    // and each of its lines has a tag, valid and dirty. Its set bits take
+    // the sector bits, so its tags are as long as the block tags here.
+    int64_t lines = sets * ways * sectors;
+    int line_tag_bits =
+        SetIndex(sets * sectors, lineBits).getTagBits(addrBits);
+    int64_t unsectored = lines * (line_tag_bits + 2) / 8;
+    int64_t accesses = hits + misses;
+
+    std::cout << name << " block misses: " << blockMisses;
+    std::cout << " sector misses: " << sectorMisses;
+    std::cout << " miss rate: "
+              << (accesses ? 100.0 * misses / accesses : 0) << "%"
+              << std::endl;
+    std::cout << name << " tag bytes: " << tagArray.getSize();
+    std::cout << " one tag per line: " << unsectored;
+    std::cout << " saved: "
+              << 100.0 * (unsectored - tagArray.getSize()) / unsectored
+              << "%" << std::endl;
+    delete replacement;
+}
+
+void
+SectoredCache::setReplacement(ReplacementPolicy::Type type)
+{
+    delete replacement;
+    replacement = ReplacementPolicy::create(type, sets, ways);
+}
+
+bool
+SectoredCache::receiveRequest(uint64_t address, int size, const uint8_t* data,
+                              int request_id)
+{
+    if (!startRequest(address, size, blocked)) return false;
+
+    int64_t set = getSetIndex(address);
+    int sector = getSector(address);
+    uint64_t line_address = address & ~(lineSize - 1);
+    int way = findBlock(address);
+    int index = set * ways + way;
+    uint32_t state = way < 0 ? 0 : tagArray.getState(index);
+    if (!(state & validBit(sector)) && writebackBuffer) {
+        // A parked sector is still in the cache, even for writes that
+        // would not allocate.
+        if (!unpark(address, way)) {
+            return rejectRequest();
+        }
+        index = set * ways + way;
+        state = way < 0 ? 0 : tagArray.getState(index);
+    }
+
+    if (state & validBit(sector)) {
+        if (!writeThroughHit(address, size, data)) return false;
+        DPRINT("Hit in cache");
+        hits++;
+        uint8_t* line = getSectorData(index, sector);
+        int block_offset = getBlockOffset(address);
+
+        if (data) {
+            // if this is a write, copy the data into the cache.
+            memcpy(&line[block_offset], data, size);
+            sendResponse(request_id, nullptr);
+            // Mark dirty, unless the write already went down
+            if (writePolicy != WriteThrough) {
+                tagArray.setState(index, state | dirtyBit(sector));
+            }
+        } else {
+            // This is a read so we need to return data
+            sendResponse(request_id, &line[block_offset], size);
+        }
+        replacement->touch(set, way);
+        if (data && writePolicy == WriteThrough) drainWrites();
+        return true;
+    }
+
+    if (data && writePolicy != WriteBack) {
+        // Do not allocate, only send the write down.
+        return writeAround(address, size, data, request_id);
+    }
+
+    DPRINT("Miss in cache " << state);
+    // Older writes to the sector must get there before it is read.
+    if (!flushWrites(line_address)) {
+        return rejectRequest();
+    }
+
+    bool block_miss = way < 0;
+    if (block_miss) {
+        // The whole block is replaced.
+        way = replacement->getVictim(set);
+        index = set * ways + way;
+        if (!evictBlock(index)) {
+            // Memory is full. The sectors that left are invalid, so the
+            // processor can retry the request when memory has space.
+            return rejectRequest();
+        }
+        tagArray.setTag(index, getTag(address));
+    }
+
+    // Forward to memory and block the cache.
+    // Fill in the MSHR first, a cache below may respond right away.
+    mshr.savedId = request_id;
+    mshr.savedAddr = address;
+    mshr.target = index;
+    // Remember the data if it is a write. It must be copied.
+    mshr.savedSize = size;
+    if (data) {
+        writeBuffer.assign(data, data + size);
+        data = writeBuffer.data();
+    }
+    mshr.savedData = data;
+    mshr.newBlock = block_miss;
+    blocked = true;
+
+    if (!sendMemRequest(line_address, lineSize, nullptr, 0)) {
+        // Nothing is waiting for the sector, so a retry is a plain miss.
+        blocked = false;
+        return rejectRequest();
+    }
+    misses++;
+    if (block_miss) {
+        blockMisses++;
+    } else {
+        sectorMisses++;
+    }
+    return true;
+}
+
+void
+SectoredCache::receiveMemResponse(int request_id, const uint8_t* data)
+{
+    assert(request_id == 0);
+    assert(data);
+
+    int index = mshr.target;
+    int sector = getSector(mshr.savedAddr);
+    uint32_t state = tagArray.getState(index);
+    assert(!(state & validBit(sector)));
+
+    // The fill takes a port of its bank.
+    fillBank(mshr.savedAddr);
+
+    // Copy the data into the cache.
+    uint8_t* line = getSectorData(index, sector);
+    memcpy(line, data, lineSize);
+    state |= validBit(sector);
+    if (mshr.newBlock) {
+        // Inserted on the fill, so a miss memory turned away and retried
+        // is only inserted once.
+        replacement->insert(index / ways, index % ways, true);
+    }
+
+    // Treat as a hit
+    int block_offset = getBlockOffset(mshr.savedAddr);
+    if (mshr.savedData) {
+        // if this is a write, copy the data into the cache.
+        memcpy(&line[block_offset], mshr.savedData, mshr.savedSize);
+        state |= dirtyBit(sector);
+        tagArray.setState(index, state);
+        sendResponse(mshr.savedId, nullptr);
+    } else {
+        // This is a read so we need to return data
+        tagArray.setState(index, state);
+        sendResponse(mshr.savedId, &line[block_offset], mshr.savedSize);
+    }
+
+    blocked = false;
+    mshr.savedId = -1;
+    mshr.savedAddr = 0;
+    mshr.target = 0;
+    mshr.savedSize = 0;
+    mshr.savedData = nullptr;
+    mshr.newBlock = false;
+
+    // Let the level above send the request that was blocked.
+    sendRetry();
+}
+
+bool
+SectoredCache::invalidateLine(uint64_t address, uint8_t* data,
+                              bool was_dirty)
+{
+    int way = findBlock(address);
+    if (way < 0) return was_dirty;
+
+    int64_t set = getSetIndex(address);
+    int index = set * ways + way;
+    int sector = getSector(address);
+    uint32_t state = tagArray.getState(index);
+    if (!(state & validBit(sector))) return was_dirty;
+
+    if ((state & dirtyBit(sector)) && !was_dirty) {
+        memcpy(data, getSectorData(index, sector), lineSize);
+        was_dirty = true;
+    }
+    state &= ~(validBit(sector) | dirtyBit(sector));
+    tagArray.setState(index, state);
+    if (state == 0) {
+        replacement->invalidate(set, way);
+    }
+    return was_dirty;
+}
+
+bool
+SectoredCache::unpark(uint64_t address, int &way)
+{
+    uint64_t line_address = address & ~(lineSize - 1);
+    if (writebackBuffer->find(line_address) < 0) return true;
+
+    int64_t set = getSetIndex(address);
+    if (way < 0) {
+        // The sector stays parked until its block has a way.
+        int victim = replacement->getVictim(set);
+        int index = set * ways + victim;
+        if (!evictBlock(index)) {
+            return false;
+        }
+        tagArray.setTag(index, getTag(address));
+        replacement->insert(set, victim, false);
+        way = victim;
+    }
+
+    // The sector never left the cache, take it back.
+    int index = set * ways + way;
+    int sector = getSector(address);
+    int parked = writebackBuffer->find(line_address);
+    writebackBuffer->hits++;
+    memcpy(getSectorData(index, sector), writebackBuffer->getLine(parked),
+           lineSize);
+    writebackBuffer->remove(parked);
+    tagArray.setState(index, tagArray.getState(index) |
+                      validBit(sector) | dirtyBit(sector));
+    return true;
+}
+
+bool
+SectoredCache::evictBlock(int index)
+{
+    uint32_t state = tagArray.getState(index);
+    uint64_t block_address = getBlockAddress(index);
+    for (int sector = 0; sector < sectors; sector++) {
+        if (!(state & validBit(sector))) continue;
+
+        uint64_t address =
+            block_address | ((uint64_t)sector << lineBits);
+        uint8_t* line = getSectorData(index, sector);
+        if (state & dirtyBit(sector)) {
+            DPRINT("Dirty, writing back");
+            if (!writeBackSector(address, line)) {
+                return false;
+            }
+        } else {
+            // Let an exclusive level below keep the clean sector.
+            sendEviction(address, line);
+        }
+        state &= ~(validBit(sector) | dirtyBit(sector));
+        tagArray.setState(index, state);
+    }
+    return true;
+}
+
+bool
+SectoredCache::writeBackSector(uint64_t address, const uint8_t* data)
+{
+    if (writebackBuffer && !writebackBuffer->isFull()) {
+        writebackBuffer->park(address, data);
+    } else if (!sendMemRequest(address, lineSize, data, -1)) {
+        // No response for writes, no need for valid request_id
+        return false;
+    }
+    writebacks++;
+    return true;
+}
+
+int64_t
+SectoredCache::getSetIndex(uint64_t address)
+{
+    return setIndex.getSet(address);
+}
+
+int
+SectoredCache::getSector(uint64_t address)
+{
+    return (address >> lineBits) & (sectors - 1);
+}
+
+int
+SectoredCache::getBlockOffset(uint64_t address)
+{
+    return address & (lineSize - 1);
+}
+
+uint64_t
+SectoredCache::getTag(uint64_t address)
+{
+    return setIndex.getTag(address);
+}
+
+int
+SectoredCache::findBlock(uint64_t address)
+{
+    // a block is valid if any of its sectors is
+    return tagArray.findWay(getSetIndex(address), getTag(address));
+}
+
+uint64_t
+SectoredCache::getBlockAddress(int index)
+{
+    return setIndex.getAddress(tagArray.getTag(index), index / ways);
+}
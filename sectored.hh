@@ -0,0 +1,168 @@
+#ifndef CSIM_SECTORED_H
+#define CSIM_SECTORED_H
+
+#include <cstdint>
+#include <vector>
+
+#include "cache.hh"
+#include "replacement.hh"
+#include "set_index.hh"
+#include "sram_array.hh"
+#include "tag_array.hh"
+
+/**
+ * A set associative cache where one tag covers a block of several lines,
+ * called sectors. Each sector has its own valid and dirty bits, a miss only
+ * fetches the sector that was asked for, and only dirty sectors are written
+ * back. Fewer tags are needed for the same capacity, at the cost of blocks
+ * that are only partly used.
+ *
+ * The level above sees sectors as lines. Blocking, like
+ * SetAssociativeCache.
+ */
+class SectoredCache: public Cache
+{
+  public:
+    /**
+     * @param size the *total* size of the cache in bytes
+     * @param memory the memory or cache that is below this cache
+     * @param processor the processor this cache is connected to
+     * @param ways the number of ways in each set
+     * @param sectors the number of lines in each block, a power of two and
+     *        at most 16
+     */
+    SectoredCache(int64_t size, ResponsePort& memory, Processor& processor,
+                  int ways, int sectors);
+
+    /**
+     * Prints the sector statistics and the tag array savings
+     */
+    ~SectoredCache() override;
+
+    /**
+     * Called when the processors sends load or store request.
+     * All requests can be assummed to be naturally aligned (e.g., a 4 byte
+     * request will be aligned to a 4 byte boundary)
+     *
+     * @param address of the request
+     * @param size in bytes of the request.
+     * @param data is non-null, then this is a store request.
+     * @param request_id the id that must be used when replying to this request
+     *
+     * @return true if the request can be received, false if the cache is
+     *         blocked and the request must be retried later.
+     */
+    bool receiveRequest(uint64_t address, int size, const uint8_t* data,
+                        int request_id) override;
+
+    /**
+     * Called when memory has the sector of the blocking miss.
+     *
+     * @param request_id is the id assigned to this request in sendMemRequest
+     * @param data is the sector (length of data is line length)
+     *        NOTE: This pointer will be invalid when this function returns.
+     */
+    void receiveMemResponse(int request_id, const uint8_t* data) override;
+
+    /**
+     * Sets the replacement policy for blocks. The default is LRU.
+     */
+    void setReplacement(ReplacementPolicy::Type type);
+
+    /**
+     * Store each tag and state in exactly the bits they need.
+     */
+    void setPackedTags(bool packed) { tagArray.setPacked(packed); }
+
+  private:
+    /// Only the sector of address is invalidated.
+    bool invalidateLine(uint64_t address, uint8_t* data,
+                        bool was_dirty) override;
+
+    int64_t getSetIndex(uint64_t address);
+    int getSector(uint64_t address);
+    int getBlockOffset(uint64_t address);
+    uint64_t getTag(uint64_t address);
+
+    /// @return the way of the block of address, or -1
+    int findBlock(uint64_t address);
+
+    /// @return the address of the block at index
+    uint64_t getBlockAddress(int index);
+
+    uint32_t validBit(int sector) { return 1u << sector; }
+    uint32_t dirtyBit(int sector) { return 1u << (sectors + sector); }
+
+    /// @return the data of sector of the block at index
+    uint8_t* getSectorData(int index, int sector) {
+        return dataArray.getLine(index * sectors + sector);
+    }
+
+    /**
+     * Take the sector of address back out of the writeback buffer if it is
+     * parked there, replacing a block if its own is not in the cache.
+     *
+     * @param way of the block of address, or -1. Set to the way the sector
+     *        is in if it was parked.
+     * @return false if memory is full
+     */
+    bool unpark(uint64_t address, int &way);
+
+    /**
+     * Write back or pass on the valid sectors of the block at index, one
+     * at a time. Each sector is invalid once it is gone, so if memory fills
+     * up part way a retry carries on from there.
+     *
+     * @return false if memory is full
+     */
+    bool evictBlock(int index);
+
+    /**
+     * Park a dirty sector, or send it below if there is no room.
+     *
+     * @return false if memory is full
+     */
+    bool writeBackSector(uint64_t address, const uint8_t* data);
+
+    int ways;
+    int64_t sets;
+    int sectors;
+    int sectorBits;
+
+    /// Splits addresses into set and tag
+    SetIndex setIndex;
+
+    /// Number of tag bits in the address
+    int64_t tagBits;
+
+    ReplacementPolicy *replacement;
+
+    /// One tag per block. Sector i has valid bit i and dirty bit
+    /// sectors + i.
+    TagArray tagArray;
+
+    /// Sector i of block b is line b * sectors + i
+    SRAMArray dataArray;
+
+    /// If true, the cache is waiting for a sector
+    bool blocked;
+
+    struct MSHR {
+        int savedId;
+        uint64_t savedAddr;
+        int target; // block the sector is filled into
+        int savedSize;
+        const uint8_t* savedData;
+        bool newBlock; // the block was replaced for this miss
+    };
+
+    MSHR mshr;
+
+    /// Copy of the data of a write miss. savedData points here.
+    std::vector<uint8_t> writeBuffer;
+
+    int64_t blockMisses; // misses that replaced a block
+    int64_t sectorMisses; // misses to an invalid sector of a present block
+};
+
+#endif // CSIM_SECTORED_H
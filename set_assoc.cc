@@ -6,111 +6,247 @@
 #include "processor.hh"
 #include "util.hh"
 
-SetAssociativeCache::SetAssociativeCache(int64_t size, Memory& memory,
+SetAssociativeCache::SetAssociativeCache(int64_t size, ResponsePort& memory,
                                          Processor& processor, int ways)
+: SetAssociativeCache(size, memory, processor, ways, 2)
+{
+
+}
+
+SetAssociativeCache::SetAssociativeCache(int64_t size, ResponsePort& memory,
+                                         Processor& processor, int ways,
+                                         int state_bits)
 : Cache(size, memory, processor), way(ways),
-tagBits(processor.getAddrSize()
-        - log2int(size / memory.getLineSize() / ways)
-        - memory.getLineBits()),
-indexMask(size / memory.getLineSize() / way - 1),
-tagArray((int) size / memory.getLineSize(),
-         log2int(ways) + 2, // lg(ways) for lru bits and 2 for valid and dirty
-         (int) tagBits),
-dataArray(size / memory.getLineSize(), memory.getLineSize()),
-blocked(false),
+sets(size / lineSize / ways),
+replacement(ReplacementPolicy::create(ReplacementPolicy::LRU,
+                                      size / lineSize / ways,
+                                      ways)),
+replacementType(ReplacementPolicy::LRU), tagIndex(nullptr),
+setIndex(size / lineSize / ways, lineBits),
+tagBits(setIndex.getTagBits(addrBits)),
+tagArray((int) size / lineSize,
+         state_bits, // valid and dirty, replacement keeps its own state
+         (int) tagBits,
+         ways,
+         1), // Valid and Dirty both have the low bit set
+dataArray(size / lineSize, lineSize),
+victims(nullptr), victimHits(0), victimSwaps(0), victimWritebacks(0),
+predictor(nullptr), lookups(0), lookupHits(0), correctPredictions(0),
+tagReads(0), dataReads(0), blocked(false),
 mshr({-1, 0, 0, 0, nullptr})
 {
     assert(ways > 0);
-    assert(log2int(ways) + 2 <= 32);
-    assert(ways <= size / memory.getLineSize());
-    // initialize lru
-    for (int i = 0; i < (int) size / memory.getLineSize(); i += way) {
-        for (int j = 0; j < way; j++) {
-            int lru = (way - 1 - j) << 2;
-            int line = j + i;
-            tagArray.setState(line, lru);
+    assert(state_bits >= 2);
+    assert(ways <= size / lineSize);
+    assert(sets * ways * lineSize == size);
+}
+
+SetAssociativeCache::~SetAssociativeCache()
+{
+    if (victims) {
+        std::cout << name << " victim hits: " << victimHits;
+        std::cout << " swaps: " << victimSwaps;
+        std::cout << " writebacks: " << victimWritebacks << std::endl;
+    }
+    if (predictor) {
+        // Without prediction every lookup reads all tags and lines of a set.
+        int64_t all = lookups * way;
+        std::cout << name << " way prediction accuracy: "
+                  << (lookupHits ? 100.0 * correctPredictions / lookupHits : 0)
+                  << "% of " << lookupHits << " hits" << std::endl;
+        std::cout << name << " tag reads: " << tagReads;
+        std::cout << " saved: " << all - tagReads;
+        std::cout << " data reads: " << dataReads;
+        std::cout << " saved: " << all - dataReads << std::endl;
+    }
+    delete victims;
+    delete replacement;
+    delete tagIndex;
+    delete predictor;
+}
+
+void
+SetAssociativeCache::setReplacement(ReplacementPolicy::Type type)
+{
+    delete replacement;
+    replacement = ReplacementPolicy::create(type, sets, way);
+    replacementType = type;
+}
+
+void
+SetAssociativeCache::setVictimCache(int entries)
+{
+    delete victims;
+    victims = nullptr;
+    if (entries > 0) {
+        victims = new VictimCache(entries, lineBits,
+                                  addrBits);
+    }
+}
+
+void
+SetAssociativeCache::setHashedLookup(bool enable)
+{
+    delete tagIndex;
+    tagIndex = nullptr;
+    if (!enable) return;
+
+    tagIndex = new TagIndex(sets * way);
+    for (int index = 0; index < sets * way; index++) {
+        if (tagArray.getState(index) & statemask) {
+            addLine(index);
         }
     }
 }
 
-SetAssociativeCache::~SetAssociativeCache()
+void
+SetAssociativeCache::setWayPrediction(WayPredictor::Type type)
+{
+    delete predictor;
+    predictor = WayPredictor::create(type, sets, way);
+}
+
+namespace {
+
+// Builds a fixed cache for the geometry CommonGeometries picks
+template <ReplacementPolicy::Type Type>
+struct Builder
 {
+    typedef SetAssociativeCache* Result;
 
+    template <class Geometry>
+    Result build() const
+    {
+        return new FixedCache<SetAssociativeCache, Geometry, Type>(
+            size, memory, processor, ways);
+    }
+
+    int64_t size;
+    ResponsePort &memory;
+    Processor &processor;
+    int ways;
+};
+
+} // anonymous namespace
+
+SetAssociativeCache*
+SetAssociativeCache::create(int64_t size, ResponsePort& memory,
+                            Processor& processor, int ways,
+                            ReplacementPolicy::Type policy)
+{
+    int line_size = memory.getLineSize();
+    int64_t sets = size / line_size / ways;
+    SetAssociativeCache *cache = nullptr;
+    if (policy == ReplacementPolicy::LRU) {
+        Builder<ReplacementPolicy::LRU> builder =
+            {size, memory, processor, ways};
+        cache = CommonGeometries::build(builder, line_size, sets, ways);
+    } else if (policy == ReplacementPolicy::TreePLRU) {
+        Builder<ReplacementPolicy::TreePLRU> builder =
+            {size, memory, processor, ways};
+        cache = CommonGeometries::build(builder, line_size, sets, ways);
+    }
+    if (!cache) {
+        cache = new SetAssociativeCache(size, memory, processor, ways);
+        cache->setReplacement(policy);
+    }
+    return cache;
 }
 
 bool
 SetAssociativeCache::receiveRequest(uint64_t address, int size,
                                     const uint8_t* data, int request_id)
 {
-    assert(size <= memory.getLineSize()); // within line size
-    // within address range
-    assert(address < ((uint64_t)1 << processor.getAddrSize()));
-    assert((address & (size - 1)) == 0); // naturally aligned
+    return access(CacheGeometry(setIndex, lineSize, way), *replacement,
+                  address, size, data, request_id);
+}
 
-    if (blocked) {
-        DPRINT("Cache is blocked!");
-        // Cache is currently blocked, so it cannot receive a new request
-        return false;
+template <class Geometry, class Policy>
+bool
+SetAssociativeCache::access(const Geometry &geometry, Policy &policy,
+                            uint64_t address, int size, const uint8_t* data,
+                            int request_id)
+{
+    if (!startRequest(address, size, blocked)) return false;
+
+    int set = (int) geometry.getSet(address);
+    uint64_t tag = geometry.getTag(address);
+    int linenum = lookup(geometry, address, set, tag); // get the hit linenum
+    if (linenum == NOTHIT) {
+        linenum = swapFromVictims(address);
     }
-    int set = (int) getSetIndex(address);
-    int linenum = hit(address); // get the hit linenum
-    int index= set * way + linenum;
+    if (linenum == NOTHIT && writebackBuffer) {
+        linenum = unpark(address);
+    }
+    int index = set * geometry.getWays() + linenum;
     
     if (linenum != NOTHIT) { // hit
+        if (!writeThroughHit(address, size, data)) return false;
         DPRINT("Hit in cache");
+        hits++;
         // get a pointer to the data
         uint8_t* line = dataArray.getLine(index);
 
-        int block_offset = getBlockOffset(address);
+        int block_offset = geometry.getOffset(address);
 
         if (data) {
             // if this is a write, copy the data into the cache.
             memcpy(&line[block_offset], data, size);
             sendResponse(request_id, nullptr);
-            // Mark dirty
-            int lru = tagArray.getState(index) >> 2;
-            int state = (lru << 2) | Dirty;
-            tagArray.setState(index, state);
+            // Mark dirty, unless the write already went down
+            if (writePolicy != WriteThrough) {
+                tagArray.setState(index, Dirty);
+            }
         } else {
             // This is a read so we need to return data
-            sendResponse(request_id, &line[block_offset]);
+            sendResponse(request_id, &line[block_offset], size);
         }
-        setlru(address, linenum);
+        policy.touch(set, linenum);
+        if (data && writePolicy == WriteThrough) drainWrites();
+    } else if (data && writePolicy != WriteBack) {
+        // Do not allocate, only send the write down.
+        return writeAround(address, size, data, request_id);
     } else {
-        linenum = findlru(address);
-        index = set * way + linenum;
+        // Older writes to the line must get there before it is read.
+        uint64_t block_address = address - geometry.getOffset(address);
+        if (!flushWrites(block_address)) {
+            return rejectRequest();
+        }
+        linenum = policy.getVictim(set);
+        index = set * geometry.getWays() + linenum;
         DPRINT("Miss in cache " << (tagArray.getState(index) & statemask));
-        if (dirty(address, linenum)) {
-            DPRINT("Dirty, writing back");
-            // If the line is dirty, then we need to evict it.
-            uint8_t* line = dataArray.getLine(index);
-            // Calculate the address of the writeback.
-            uint64_t wb_address =
-            tagArray.getTag(index) << (processor.getAddrSize() - tagBits);
-            wb_address |= (set << memory.getLineBits());
-            // No response for writes, no need for valid request_id
-            sendMemRequest(wb_address, memory.getLineSize(), line, -1);
+        if (!makeRoom(index)) {
+            // Memory is full. Nothing has changed yet, so the processor
+            // can retry the whole request when memory has space.
+            return rejectRequest();
         }
 
-        int lru = tagArray.getState(index) >> 2;
-        int state = (lru << 2) | Invalid;
-        tagArray.setState(index, state);
-        setlru(address, linenum);
         // Forward to memory and block the cache.
         // no need for req id since there is only one outstanding request.
         // We need to read whether the request is a read or write.
-        uint64_t block_address = address & ~(memory.getLineSize() - 1);
-        sendMemRequest(block_address, memory.getLineSize(), nullptr, 0);
+        // Fill in the MSHR first, a cache below may respond right away.
         // remember the CPU's request id
         mshr.savedId = request_id;
         // Remember the address
         mshr.savedAddr = address;
         mshr.target = index;
-        // Remember the data if it is a write.
+        // Remember the data if it is a write. It must be copied.
         mshr.savedSize = size;
+        if (data) {
+            writeBuffer.assign(data, data + size);
+            data = writeBuffer.data();
+        }
         mshr.savedData = data;
         // Mark the cache as blocked
         blocked = true;
+
+        if (!sendMemRequest(block_address, geometry.getLineSize(), nullptr,
+                            0)) {
+            // The line is clean and invalid now, so a retry is a plain miss.
+            blocked = false;
+            return rejectRequest();
+        }
+        misses++;
     }
     return true;
 }
@@ -121,9 +257,12 @@ SetAssociativeCache::receiveMemResponse(int request_id, const uint8_t* data)
     assert(request_id == 0);
     assert(data);
 
+    // The fill takes a port of its bank.
+    fillBank(mshr.savedAddr);
+
     // Copy the data into the cache.
     uint8_t* line = dataArray.getLine(mshr.target);
-    memcpy(line, data, memory.getLineSize());
+    memcpy(line, data, lineSize);
 
     assert((tagArray.getState(mshr.target) & statemask) == Invalid);
 
@@ -133,6 +272,10 @@ SetAssociativeCache::receiveMemResponse(int request_id, const uint8_t* data)
 
     // Set tag
     tagArray.setTag(mshr.target, getTag(mshr.savedAddr));
+    addLine(mshr.target);
+    // Inserted on the fill, so a miss memory turned away and retried is
+    // only inserted once.
+    replacement->insert(mshr.target / way, mshr.target % way, true);
 
     // Treat as a hit
     int block_offset = getBlockOffset(mshr.savedAddr);
@@ -146,7 +289,7 @@ SetAssociativeCache::receiveMemResponse(int request_id, const uint8_t* data)
         tagArray.setState(mshr.target, state);
     } else {
         // This is a read so we need to return data
-        sendResponse(mshr.savedId, &line[block_offset]);
+        sendResponse(mshr.savedId, &line[block_offset], mshr.savedSize);
     }
 
     blocked = false;
@@ -155,81 +298,216 @@ SetAssociativeCache::receiveMemResponse(int request_id, const uint8_t* data)
     mshr.target = 0;
     mshr.savedSize = 0;
     mshr.savedData = nullptr;
+
+    // Let the level above send the request that was blocked.
+    sendRetry();
 }
 
-void SetAssociativeCache::setlru(uint64_t address, int linenum)
+bool
+SetAssociativeCache::invalidateLine(uint64_t address, uint8_t* data,
+                                    bool was_dirty)
 {
-    int set = (int) getSetIndex(address);
-    uint32_t index, state;
-    uint32_t lru;
-    for (int i = 0; i < way; i++) {
-        if (i != linenum && getlru(address, i) < getlru(address, linenum)){
-            lru = (uint32_t) (getlru(address, i) + 1) << 2;
-            index = set * way + i;
-            state = (tagArray.getState(index) & statemask);
-            state |= lru;
-            tagArray.setState(index, state);
+    int linenum = hit(address);
+    if (linenum == NOTHIT) {
+        int entry = victims ? victims->find(address) : -1;
+        if (entry < 0) return was_dirty;
+        if (victims->isDirty(entry) && !was_dirty) {
+            memcpy(data, victims->getLine(entry), lineSize);
+            was_dirty = true;
         }
+        victims->invalidate(entry);
+        return was_dirty;
     }
 
-    index = set * way + linenum;
-    state = tagArray.getState(index) & statemask;
-    tagArray.setState(index, state);
+    int set = getSetIndex(address);
+    int index = set * way + linenum;
+    if (dirty(address, linenum) && !was_dirty) {
+        memcpy(data, dataArray.getLine(index), lineSize);
+        was_dirty = true;
+    }
+    removeLine(index);
+    tagArray.setState(index, Invalid);
+    replacement->invalidate(set, linenum);
+    return was_dirty;
 }
 
-int64_t
-SetAssociativeCache::getlru(uint64_t address, int linenum)
+bool
+SetAssociativeCache::makeRoom(int index)
 {
-    int set = (int) getSetIndex(address);
-    int index = set * way + linenum;
-    return tagArray.getState(index) >> 2;
+    int state = tagArray.getState(index) & statemask;
+    if (state == Invalid) return true;
+
+    uint8_t* line = dataArray.getLine(index);
+    if (victims) {
+        // The victim cache takes the line and gives up its oldest.
+        int entry = victims->getVictim();
+        if (victims->isValid(entry)) {
+            if (!evictToMemory(victims->getAddress(entry),
+                               victims->getLine(entry),
+                               victims->isDirty(entry))) {
+                return false;
+            }
+            if (victims->isDirty(entry)) victimWritebacks++;
+        }
+        victims->fill(entry, getLineAddress(index), line, state == Dirty);
+    } else if (!evictToMemory(getLineAddress(index), line, state == Dirty)) {
+        return false;
+    }
+    removeLine(index);
+    tagArray.setState(index, Invalid);
+    return true;
+}
+
+bool
+SetAssociativeCache::evictToMemory(uint64_t address, const uint8_t* line,
+                                   bool dirty)
+{
+    if (dirty) {
+        DPRINT("Dirty, writing back");
+        if (writebackBuffer) {
+            if (writebackBuffer->isFull()) {
+                writebackStalls++;
+                return false;
+            }
+            writebackBuffer->park(address, line);
+        } else if (!sendMemRequest(address, lineSize, line, -1)) {
+            // No response for writes, no need for valid request_id
+            return false;
+        }
+        writebacks++;
+    } else {
+        // Let an exclusive level below keep the clean line.
+        sendEviction(address, line);
+    }
+    return true;
 }
 
 int
-SetAssociativeCache::findlru(uint64_t address)
+SetAssociativeCache::swapFromVictims(uint64_t address)
 {
-    int lruindex = 0;
-    for (int i = 1; i < way; i++)
-    {
-        if (getlru(address, i) > getlru(address, lruindex))
-            lruindex = i;
+    int entry = victims ? victims->find(address) : -1;
+    if (entry < 0) return NOTHIT;
+    victimHits++;
+
+    int set = getSetIndex(address);
+    int linenum = replacement->getVictim(set);
+    int index = set * way + linenum;
+    uint8_t* line = dataArray.getLine(index);
+    bool was_dirty = victims->isDirty(entry);
+    int was_prefetched = victims->isPrefetched(entry) ? prefetchedBit : 0;
+    swapBuffer.assign(victims->getLine(entry),
+                      victims->getLine(entry) + lineSize);
+
+    // The line it replaces takes its place in the victim cache.
+    int state = tagArray.getState(index) & statemask;
+    if (state != Invalid) {
+        victimSwaps++;
+        victims->fill(entry, getLineAddress(index), line, state == Dirty,
+                      tagArray.getState(index) & prefetchedBit);
+        removeLine(index);
+    } else {
+        victims->invalidate(entry);
     }
-    return lruindex;
+
+    tagArray.setTag(index, getTag(address));
+    memcpy(line, swapBuffer.data(), lineSize);
+    tagArray.setState(index, (was_dirty ? Dirty : Valid) | was_prefetched);
+    addLine(index);
+    replacement->insert(set, linenum, false);
+    return linenum;
+}
+
+int
+SetAssociativeCache::unpark(uint64_t address)
+{
+    int entry =
+        writebackBuffer->find(address & ~(lineSize - 1));
+    if (entry < 0) return NOTHIT;
+    writebackBuffer->hits++;
+
+    // The parked line leaves first, so its own entry has room for a dirty
+    // line it replaces.
+    swapBuffer.assign(writebackBuffer->getLine(entry),
+                      writebackBuffer->getLine(entry) + lineSize);
+    writebackBuffer->remove(entry);
+
+    int set = getSetIndex(address);
+    int linenum = replacement->getVictim(set);
+    int index = set * way + linenum;
+    bool evicted = makeRoom(index);
+    assert(evicted);
+
+    tagArray.setTag(index, getTag(address));
+    memcpy(dataArray.getLine(index), swapBuffer.data(), lineSize);
+    tagArray.setState(index, Dirty);
+    addLine(index);
+    replacement->insert(set, linenum, false);
+    return linenum;
+}
+
+bool
+SetAssociativeCache::inVictims(uint64_t address)
+{
+    return victims && victims->find(address) >= 0;
 }
 
 int64_t
 SetAssociativeCache::getSetIndex(uint64_t address)
 {
-    return (address >> memory.getLineBits()) & indexMask;
+    return setIndex.getSet(address);
 }
 
 int
 SetAssociativeCache::getBlockOffset(uint64_t address)
 {
-    return address & (memory.getLineSize() - 1);
+    return address & (lineSize - 1);
 }
 
 uint64_t
 SetAssociativeCache::getTag(uint64_t address)
 {
-    return address >> (processor.getAddrSize() - tagBits);
+    return setIndex.getTag(address);
 }
 
 int
 SetAssociativeCache::hit(uint64_t address)
 {
-    int set = (int) getSetIndex(address);
-    int start = set * way;
-    for (int index = 0; index < way; index++)
-    {
-        State state = (State)(tagArray.getState(start + index) & statemask);
-        uint64_t line_tag = tagArray.getTag(start + index);
-        if ((state == Valid || state == Dirty) && // dirty implies valid
-            line_tag == getTag(address))
-            return index;
+    return hit(CacheGeometry(setIndex, lineSize, way), address,
+               getSetIndex(address), getTag(address));
+}
+
+int
+SetAssociativeCache::hashedHit(uint64_t address, int64_t set)
+{
+    int64_t index = tagIndex->find(address >> lineBits);
+    return index < 0 ? NOTHIT : index - set * way;
+}
+
+int
+SetAssociativeCache::predictWay(uint64_t address, int64_t set, int linenum)
+{
+    uint64_t line_address = address >> lineBits;
+    lookups++;
+    if (linenum != NOTHIT) {
+        lookupHits++;
+    }
+    if (linenum == predictor->predict(set, line_address)) {
+        // Only the predicted way was read.
+        correctPredictions++;
+        tagReads++;
+        dataReads++;
+        return linenum;
     }
 
-    return NOTHIT;
+    // The predicted way was read for nothing, then the whole set is
+    // probed the next tick.
+    tagReads += way;
+    dataReads += linenum == NOTHIT ? 1 : 2;
+    extendAccess(1);
+    if (linenum != NOTHIT) {
+        predictor->update(set, line_address, linenum);
+    }
+    return linenum;
 }
 
 bool
@@ -243,3 +521,31 @@ SetAssociativeCache::dirty(uint64_t address, int linenum)
     else
         return false;
 }
+
+uint64_t
+SetAssociativeCache::getLineAddress(int index)
+{
+    return setIndex.getAddress(tagArray.getTag(index), index / way);
+}
+
+void
+SetAssociativeCache::addLine(int index)
+{
+    if (tagIndex) {
+        tagIndex->insert(getLineAddress(index) >> lineBits, index);
+    }
+    if (predictor) {
+        // The way filled last is the best guess for its line.
+        predictor->update(index / way,
+                          getLineAddress(index) >> lineBits,
+                          index % way);
+    }
+}
+
+void
+SetAssociativeCache::removeLine(int index)
+{
+    if (tagIndex && (tagArray.getState(index) & statemask) != Invalid) {
+        tagIndex->erase(getLineAddress(index) >> lineBits);
+    }
+}
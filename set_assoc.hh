@@ -1,22 +1,41 @@
 #ifndef CSIM_SET_ASSOC_H
 #define CSIM_SET_ASSOC_H
 
-#include "tag_array.hh"
-#include "sram_array.hh"
+#include <vector>
+
 #include "cache.hh"
+#include "cache_geometry.hh"
+#include "replacement.hh"
+#include "set_index.hh"
+#include "sram_array.hh"
+#include "tag_array.hh"
+#include "tag_index.hh"
+#include "victim_cache.hh"
+#include "way_predictor.hh"
 
 class SetAssociativeCache: public Cache
 {
 public:
     /**
      * @size  the *total* size of the cache in bytes
-     * @memory the memory that is below this cache
+     * @memory the memory or cache that is below this cache
      * @processor the processor this cache is connected to
      * @ways the number of ways in this set associative cache. If the number
      *        of ways cannot be realized, this will cause an error
      */
-    SetAssociativeCache(int64_t size, Memory& memory, Processor& processor,
-                        int ways);
+    SetAssociativeCache(int64_t size, ResponsePort& memory,
+                        Processor& processor, int ways);
+
+    /**
+     * Same arguments as the constructor, plus the replacement policy.
+     * Common geometries with LRU or tree PLRU get a request path compiled
+     * for them (see cache_geometry.hh), others a plain cache. The caller
+     * owns the cache.
+     */
+    static SetAssociativeCache* create(int64_t size, ResponsePort& memory,
+                                       Processor& processor, int ways,
+                                       ReplacementPolicy::Type policy =
+                                           ReplacementPolicy::LRU);
 
     /**
      * Destructor
@@ -50,22 +69,117 @@ public:
     virtual void receiveMemResponse(int request_id, const uint8_t* data)
     override;
 
+    /**
+     * Sets the replacement policy. The default is LRU.
+     */
+    void setReplacement(ReplacementPolicy::Type type);
+
+    /**
+     * Find lines with a hash index instead of scanning the set. Use for
+     * highly associative and fully associative caches.
+     */
+    void setHashedLookup(bool enable);
+
+    /**
+     * Store each tag and state in exactly the bits they need. Lookups are
+     * slower, use for large caches.
+     */
+    void setPackedTags(bool packed) { tagArray.setPacked(packed); }
+
+    /**
+     * Keep the last entries lines evicted in a fully associative victim
+     * cache. A miss that hits there swaps the line back. Call before the
+     * simulation starts.
+     */
+    void setVictimCache(int entries);
+
+    /**
+     * Probe the way a predictor of type picks before the rest of the set.
+     * A correct guess reads one tag and one line, a wrong one reads the
+     * whole set a tick later. Call before the simulation starts.
+     */
+    void setWayPrediction(WayPredictor::Type type);
+
 protected:
-    static const int statemask = 3; // 2 bits mask
+    bool invalidateLine(uint64_t address, uint8_t* data,
+                        bool was_dirty) override;
+
+    /**
+     * @state_bits per line in the tag array, at least 2 for valid and dirty
+     */
+    SetAssociativeCache(int64_t size, ResponsePort& memory,
+                        Processor& processor, int ways, int state_bits);
+
+    /**
+     * The request path of receiveRequest, with the address math of
+     * geometry and policy calls on policy. Defined in set_assoc.cc, only
+     * receiveRequest and the caches create builds use it.
+     */
+    template <class Geometry, class Policy>
+    bool access(const Geometry &geometry, Policy &policy, uint64_t address,
+                int size, const uint8_t* data, int request_id);
+
+    static const int statemask = 3; // 2 bits mask, valid and dirty
+    // State bit of a prefetched line no demand access has used yet. Only
+    // NonBlockingCache sets it, the victim cache keeps it with the line.
+    static const int prefetchedBit = 4;
     static const int NOTHIT = -99; // indicate not hit
     int64_t getSetIndex(uint64_t address); // get set
     int getBlockOffset(uint64_t address); // get offset
     uint64_t getTag(uint64_t address); // get tag
     int hit(uint64_t address); // return hit index
+    // hit() with the set and tag of address from geometry
+    template <class Geometry>
+    int hit(const Geometry &geometry, uint64_t address, int64_t set,
+            uint64_t tag) {
+        if (tagIndex) return hashedHit(address, set);
+        // dirty implies valid, both have the valid bit the tag array checks
+        int linenum = geometry.findWay(tagArray, set, tag);
+        return linenum < 0 ? NOTHIT : linenum;
+    }
+    // hit() for a request, probing the predicted way first
+    template <class Geometry>
+    int lookup(const Geometry &geometry, uint64_t address, int64_t set,
+               uint64_t tag) {
+        int linenum = hit(geometry, address, set, tag);
+        return predictor ? predictWay(address, set, linenum) : linenum;
+    }
+    // hit() through the hash index
+    int hashedHit(uint64_t address, int64_t set);
+    // count the reads of a lookup that found linenum and train the
+    // predictor. Returns linenum.
+    int predictWay(uint64_t address, int64_t set, int linenum);
     bool dirty(uint64_t address, int linenum); // check linenum of set is dirty
-    int64_t getlru(uint64_t address, int linenum); // extract lru
-    void setlru(uint64_t address, int linenum); // reset lru
-    int findlru(uint64_t address); // find lru line index
+    uint64_t getLineAddress(int index); // address of the line at index
+    void addLine(int index); // index the valid line at index
+    void removeLine(int index); // call before the line at index is invalid
+    // on a miss, swap the line of address in from the victim cache.
+    // Returns its way, or NOTHIT if the victim cache does not have it.
+    int swapFromVictims(uint64_t address);
+    // true if the line of address is in the victim cache
+    bool inVictims(uint64_t address);
+    // on a miss, take the line of address back out of the writeback
+    // buffer. Returns its way, or NOTHIT if it is not parked there.
+    virtual int unpark(uint64_t address);
     int way;
+    int64_t sets;
+    ReplacementPolicy *replacement;
+    ReplacementPolicy::Type replacementType; // the type of replacement
+    TagIndex *tagIndex; // nullptr to scan the set
+    SetIndex setIndex;
     int64_t tagBits;
-    uint64_t indexMask;
     TagArray tagArray;
     SRAMArray dataArray;
+    VictimCache *victims; // nullptr if there is no victim cache
+    int64_t victimHits;
+    int64_t victimSwaps; // victim hits that moved a line the other way
+    int64_t victimWritebacks;
+    WayPredictor *predictor; // nullptr to read every way at once
+    int64_t lookups;
+    int64_t lookupHits;
+    int64_t correctPredictions;
+    int64_t tagReads; // tags read by lookups
+    int64_t dataReads; // lines read by lookups
 
 private:
     enum State {
@@ -84,6 +198,15 @@ private:
     };
     bool blocked;
     MSHR mshr;
+    // copy of the data of a write miss. savedData points here.
+    std::vector<uint8_t> writeBuffer;
+    // line moving out of the victim cache during a swap
+    std::vector<uint8_t> swapBuffer;
+    // evict the line at index, if any, so it can be refilled. False if
+    // memory is full, then nothing has changed.
+    bool makeRoom(int index);
+    // write back or pass on an evicted line. False if memory is full.
+    bool evictToMemory(uint64_t address, const uint8_t* line, bool dirty);
 
 };
 
@@ -0,0 +1,23 @@
+#include <cassert>
+
+#include "set_index.hh"
+
+SetIndex::SetIndex(int64_t sets, int block_bits) :
+    sets(sets), blockBits(block_bits), pow2((sets & (sets - 1)) == 0),
+    setBits(63 - __builtin_clzll(sets)), mask(sets - 1), multiplier(0)
+{
+    assert(sets > 0);
+    assert(block_bits >= 0 && block_bits < 64);
+    if (!pow2) {
+        multiplier = ~(__uint128_t)0 / sets + 1;
+    }
+}
+
+int
+SetIndex::getTagBits(int address_bits) const
+{
+    // The largest block number divided by sets needs no more bits than
+    // dividing by the power of two just below sets.
+    assert(address_bits >= blockBits + setBits);
+    return address_bits - blockBits - setBits;
+}
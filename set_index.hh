@@ -0,0 +1,72 @@
+#ifndef CSIM_SET_INDEX_H
+#define CSIM_SET_INDEX_H
+
+#include <cstdint>
+
+/**
+ * Splits an address into a set and a tag for any number of sets.
+ *
+ * The block number (address >> block_bits) is divided by the number of
+ * sets, the remainder is the set and the quotient the tag. A power of two
+ * is a mask and a shift as before. Other counts use Lemire's fastmod and
+ * fastdiv with a constant computed once, so no access pays for a hardware
+ * division.
+ */
+class SetIndex
+{
+  public:
+    /**
+     * @param sets in the cache, any number above 0
+     * @param block_bits log2 of the bytes mapped to one set at a time
+     */
+    SetIndex(int64_t sets, int block_bits);
+
+    int64_t getSet(uint64_t address) const
+    {
+        uint64_t block = address >> blockBits;
+        if (pow2) return block & mask;
+        __uint128_t low = multiplier * block;
+        return mulHigh(low, sets);
+    }
+
+    uint64_t getTag(uint64_t address) const
+    {
+        uint64_t block = address >> blockBits;
+        if (pow2) return block >> setBits;
+        return mulHigh(multiplier, block);
+    }
+
+    /**
+     * @return the address of the first byte of the block with tag in set
+     */
+    uint64_t getAddress(uint64_t tag, int64_t set) const
+    {
+        if (pow2) return ((tag << setBits) | set) << blockBits;
+        return (tag * sets + set) << blockBits;
+    }
+
+    /**
+     * @return the bits needed for any tag of an address_bits address
+     */
+    int getTagBits(int address_bits) const;
+
+  private:
+    /// The high 64 bits of the 192 bit product a * b
+    static uint64_t mulHigh(__uint128_t a, uint64_t b)
+    {
+        __uint128_t bottom = (a & ~(uint64_t)0) * (__uint128_t)b;
+        __uint128_t top = (a >> 64) * (__uint128_t)b;
+        return (top + (bottom >> 64)) >> 64;
+    }
+
+    uint64_t sets;
+    int blockBits;
+    bool pow2;
+    /// floor(log2(sets))
+    int setBits;
+    uint64_t mask;
+    /// 2^128 / sets rounded up, only for other counts
+    __uint128_t multiplier;
+};
+
+#endif // CSIM_SET_INDEX_H
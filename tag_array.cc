@@ -2,18 +2,42 @@
 #include <cassert>
 #include <iostream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
 #include "tag_array.hh"
+#include "util.hh"
+
+/**
+ * @return the valid bits from bit and up
+ */
+static inline uint64_t
+validFrom(const uint64_t *valid, int64_t bit)
+{
+    return valid[bit / 64] >> (bit & 63);
+}
 
-TagArray::TagArray(int lines, int state_bits, int tag_bits) :
-    lines(lines), stateBits(state_bits), tagBits(tag_bits)
+TagArray::TagArray(int lines, int state_bits, int tag_bits, int ways,
+                   uint32_t valid_mask) :
+    lines(lines), stateBits(state_bits), tagBits(tag_bits), ways(ways),
+    validMask(valid_mask), packed(false)
 {
     assert(stateBits <= 32);
-    assert(tagBits <= 64);
+    assert(tagBits >= 0 && tagBits <= 64);
 
     assert(lines > 0);
+    assert(ways > 0 && lines % ways == 0);
+
+    stride = getStride(ways);
+    validStride = getValidStride(stride);
 
-    tags.resize(lines, 0);
-    states.resize(lines, 0);
+    int64_t sets = lines / ways;
+    tagStorage.resize(sets * stride + tagsPerLine, 0);
+    uintptr_t base = reinterpret_cast<uintptr_t>(tagStorage.data());
+    tags = tagStorage.data() + (-base / sizeof(uint64_t)) % tagsPerLine;
+    states.resize(sets * stride, 0);
+    valid.resize((sets * validStride + 63) / 64, 0);
 
     totalSize += getSize();
 }
@@ -23,7 +47,11 @@ TagArray::getTag(int line)
 {
     assert(line >= 0);
     assert(line < lines);
-    return tags[line];
+    if (packed) {
+        return readBits((int64_t)line * (stateBits + tagBits) + stateBits,
+                        tagBits);
+    }
+    return tags[getSlot(line)];
 }
 
 uint32_t
@@ -31,29 +59,126 @@ TagArray::getState(int line)
 {
     assert(line >= 0);
     assert(line < lines);
-    return states[line];
+    if (packed) {
+        return readBits((int64_t)line * (stateBits + tagBits), stateBits);
+    }
+    return states[getSlot(line)];
 }
 
 void
 TagArray::setTag(int line, uint64_t tag)
 {
-    uint64_t tag_mask = ((uint64_t)-1) >> (64 - tagBits);
-    assert((tag & tag_mask) == tag);
-    tags[line] = tag;
+    assert(fitsInBits(tag, tagBits));
+    if (packed) {
+        writeBits((int64_t)line * (stateBits + tagBits) + stateBits, tagBits,
+                  tag);
+        return;
+    }
+    tags[getSlot(line)] = tag;
 }
 
 void
 TagArray::setState(int line, uint32_t state)
 {
-    uint64_t state_mask = ((uint64_t)-1) >> (64 - stateBits);
-    assert((state & state_mask) == state);
-    states[line] = state;
+    assert(fitsInBits(state, stateBits));
+    if (packed) {
+        writeBits((int64_t)line * (stateBits + tagBits), stateBits, state);
+    } else {
+        states[getSlot(line)] = state;
+    }
+
+    int64_t index = (int64_t)(line / ways) * validStride + line % ways;
+    uint64_t &word = valid[index / 64];
+    uint64_t bit = (uint64_t)1 << (index & 63);
+    if (state & validMask) {
+        word |= bit;
+    } else {
+        word &= ~bit;
+    }
+}
+
+void
+TagArray::setPacked(bool packed)
+{
+    if (packed == this->packed) return;
+
+    std::vector<uint64_t> old_tags(lines);
+    std::vector<uint32_t> old_states(lines);
+    for (int line = 0; line < lines; line++) {
+        old_tags[line] = getTag(line);
+        old_states[line] = getState(line);
+    }
+
+    this->packed = packed;
+    if (packed) {
+        // One extra word so a read can always look at the next word.
+        int64_t bits = (int64_t)(stateBits + tagBits) * lines;
+        packedBits.assign(bits / 64 + 2, 0);
+        std::vector<uint64_t>().swap(tagStorage);
+        std::vector<uint32_t>().swap(states);
+        tags = nullptr;
+    } else {
+        int64_t sets = lines / ways;
+        tagStorage.assign(sets * stride + tagsPerLine, 0);
+        uintptr_t base = reinterpret_cast<uintptr_t>(tagStorage.data());
+        tags = tagStorage.data() + (-base / sizeof(uint64_t)) % tagsPerLine;
+        states.assign(sets * stride, 0);
+        std::vector<uint64_t>().swap(packedBits);
+    }
+
+    for (int line = 0; line < lines; line++) {
+        setTag(line, old_tags[line]);
+        setState(line, old_states[line]);
+    }
+}
+
+uint64_t
+TagArray::readBits(int64_t offset, int width)
+{
+    int64_t word = offset / 64;
+    int shift = offset % 64;
+    uint64_t value = packedBits[word] >> shift;
+    if (shift + width > 64) {
+        value |= packedBits[word + 1] << (64 - shift);
+    }
+    return value & bitMask(width);
+}
+
+void
+TagArray::writeBits(int64_t offset, int width, uint64_t value)
+{
+    int64_t word = offset / 64;
+    int shift = offset % 64;
+    uint64_t mask = bitMask(width);
+    packedBits[word] = (packedBits[word] & ~(mask << shift)) |
+                       (value << shift);
+    if (shift + width > 64) {
+        int low = 64 - shift;
+        packedBits[word + 1] = (packedBits[word + 1] & ~(mask >> low)) |
+                               (value >> low);
+    }
+}
+
+int
+TagArray::findPacked(int64_t set, uint64_t tag)
+{
+    // Only look at the valid ways
+    int64_t first = set * validStride;
+    for (int base = 0; base < ways; base += 64) {
+        uint64_t bits = validFrom(valid.data(), first + base);
+        if (ways - base < 64) bits &= bitMask(ways - base);
+        for (; bits; bits &= bits - 1) {
+            int way = base + __builtin_ctzll(bits);
+            if (getTag(set * ways + way) == tag) return way;
+        }
+    }
+    return -1;
 }
 
 int64_t
 TagArray::getSize()
 {
-    int64_t bits = (stateBits + tagBits) * tags.size();
+    int64_t bits = (int64_t)(stateBits + tagBits) * lines;
     return bits/8;
 }
 
@@ -63,4 +188,105 @@ TagArray::getTotalSize()
     return totalSize;
 }
 
+const char*
+TagArray::getKernelName()
+{
+    return kernelName;
+}
+
+static int
+matchScalar(const uint64_t *tags, const uint64_t *valid, int64_t first,
+            int ways, uint64_t tag)
+{
+    for (int way = 0; way < ways; way++) {
+        if (tags[way] == tag && (validFrom(valid, first + way) & 1)) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse4.1")))
+static int
+matchSSE(const uint64_t *tags, const uint64_t *valid, int64_t first,
+         int ways, uint64_t tag)
+{
+    __m128i key = _mm_set1_epi64x(tag);
+    int way = 0;
+    for (; way + 2 <= ways; way += 2) {
+        __m128i line = _mm_loadu_si128((const __m128i*)&tags[way]);
+        uint64_t mask = _mm_movemask_pd(
+            _mm_castsi128_pd(_mm_cmpeq_epi64(line, key)));
+        mask &= validFrom(valid, first + way);
+        if (mask) return way + __builtin_ctzll(mask);
+    }
+    if (way < ways && tags[way] == tag &&
+        (validFrom(valid, first + way) & 1)) {
+        return way;
+    }
+    return -1;
+}
+
+__attribute__((target("avx2")))
+static int
+matchAVX2(const uint64_t *tags, const uint64_t *valid, int64_t first,
+          int ways, uint64_t tag)
+{
+    __m256i key = _mm256_set1_epi64x(tag);
+    int way = 0;
+    // A host cache line of tags at a time
+    for (; way + 8 <= ways; way += 8) {
+        __m256i low = _mm256_loadu_si256((const __m256i*)&tags[way]);
+        __m256i high = _mm256_loadu_si256((const __m256i*)&tags[way + 4]);
+        uint64_t mask = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(low, key)));
+        mask |= _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(high, key))) << 4;
+        mask &= validFrom(valid, first + way);
+        if (mask) return way + __builtin_ctzll(mask);
+    }
+    if (way + 4 <= ways) {
+        __m256i line = _mm256_loadu_si256((const __m256i*)&tags[way]);
+        uint64_t mask = _mm256_movemask_pd(
+            _mm256_castsi256_pd(_mm256_cmpeq_epi64(line, key)));
+        mask &= validFrom(valid, first + way);
+        if (mask) return way + __builtin_ctzll(mask);
+        way += 4;
+    }
+    for (; way < ways; way++) {
+        if (tags[way] == tag && (validFrom(valid, first + way) & 1)) {
+            return way;
+        }
+    }
+    return -1;
+}
+
+#endif
+
+/**
+ * Picks the widest kernel the host supports.
+ */
+static TagArray::MatchKernel
+selectKernel(const char **name)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    if (__builtin_cpu_supports("avx2")) {
+        *name = "avx2";
+        return matchAVX2;
+    }
+    if (__builtin_cpu_supports("sse4.1")) {
+        *name = "sse4.1";
+        return matchSSE;
+    }
+#endif
+    *name = "scalar";
+    return matchScalar;
+}
+
 int64_t TagArray::totalSize = 0;
+
+const char* TagArray::kernelName = "scalar";
+
+TagArray::MatchKernel TagArray::matchKernel = selectKernel(&kernelName);
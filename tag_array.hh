@@ -2,18 +2,39 @@
 #ifndef CSIM_TAG_ARRAY_H
 #define CSIM_TAG_ARRAY_H
 
+#include <cassert>
 #include <cstdint>
 #include <vector>
 
+/**
+ * Tags and states of a cache, stored set by set. The tags of a set are
+ * contiguous and each set starts on a host cache line, so findWay can
+ * compare a tag against all ways with SIMD instructions.
+ *
+ * In packed mode each line uses exactly stateBits + tagBits bits, for large
+ * caches where host memory matters more than lookup speed.
+ */
 class TagArray
 {
   public:
+    /**
+     * Compares tag against the tags of one set. The valid bit of way i is
+     * bit first + i of valid.
+     * @return the first valid way that matches, or -1
+     */
+    typedef int (*MatchKernel)(const uint64_t *tags, const uint64_t *valid,
+                               int64_t first, int ways, uint64_t tag);
+
     /**
      * Allocates the tag and state data. All data defaults to 0
      *
      * @param lines that are in the tag array
+     * @param ways in each set. Line i is way i % ways of set i / ways.
+     * @param valid_mask a line is valid if its state has one of these bits
+     *        set. Only used by findWay.
      */
-    TagArray(int lines, int state_bits, int tag_bits);
+    TagArray(int lines, int state_bits, int tag_bits, int ways = 1,
+             uint32_t valid_mask = 1);
 
     /**
      * @return a pointer to the bits that correspond to the tag for the given
@@ -37,6 +58,48 @@ class TagArray
      */
     void setState(int line, uint32_t state);
 
+    /**
+     * @return the way of set that is valid and has tag, or -1
+     */
+    int findWay(int64_t set, uint64_t tag) {
+        if (packed) return findPacked(set, tag);
+        return matchKernel(&tags[set * stride], valid.data(),
+                           set * validStride, ways, tag);
+    }
+
+    /**
+     * findWay for a tag array of exactly Ways ways. Where the set's tags
+     * and valid bits are is a constant and the compare loop has a fixed
+     * trip count, so no kernel is called.
+     */
+    template <int Ways>
+    int findWay(int64_t set, uint64_t tag) {
+        static_assert(Ways > 0 && Ways <= 64, "a set fits one valid word");
+        static const int set_stride = getStride(Ways);
+        static const int valid_stride = getValidStride(set_stride);
+        assert(ways == Ways);
+        if (packed) return findPacked(set, tag);
+        const uint64_t *set_tags = &tags[set * set_stride];
+        uint64_t match = 0;
+        for (int way = 0; way < Ways; way++) {
+            match |= (uint64_t)(set_tags[way] == tag) << way;
+        }
+        // A set of at most 64 ways never straddles a valid word.
+        int64_t first = set * valid_stride;
+        match &= valid[first / 64] >> (first & 63);
+        return match ? __builtin_ctzll(match) : -1;
+    }
+
+    /**
+     * Switch between packed and unpacked storage. The contents are kept.
+     */
+    void setPacked(bool packed);
+
+    /**
+     * @return the name of the tag match kernel this host uses
+     */
+    static const char* getKernelName();
+
     /**
      * Return the size in bytes.
      */
@@ -48,17 +111,71 @@ class TagArray
     static int64_t getTotalSize();
 
   private:
+    /// Tags in a host cache line
+    static const int tagsPerLine = 64 / sizeof(uint64_t);
+
+    /// @return the smallest power of two that is at least n and at least p
+    static constexpr int roundUpPow2(int n, int p = 1) {
+        return p >= n ? p : roundUpPow2(n, p * 2);
+    }
+
+    /// @return the slots of a set of ways ways. Small sets are rounded up to
+    ///         a power of two so they never straddle a host cache line,
+    ///         larger ones to a whole number of lines.
+    static constexpr int getStride(int ways) {
+        return ways > tagsPerLine ?
+            (ways + tagsPerLine - 1) / tagsPerLine * tagsPerLine :
+            roundUpPow2(ways);
+    }
+
+    /// @return the valid bits of a set of stride slots
+    static constexpr int getValidStride(int stride) {
+        return stride > 64 ? (stride + 63) / 64 * 64 : roundUpPow2(stride);
+    }
+
+    /// @return where line is stored in tags and states
+    int64_t getSlot(int line) {
+        return stride == ways ? line : (line / ways) * stride + line % ways;
+    }
+
+    /// @return width bits starting at bit offset of packedBits
+    uint64_t readBits(int64_t offset, int width);
+    /// Sets width bits starting at bit offset of packedBits to value
+    void writeBits(int64_t offset, int width, uint64_t value);
+
+    /// findWay in packed mode
+    int findPacked(int64_t set, uint64_t tag);
 
     int lines;
     int stateBits;
     int tagBits;
+    int ways;
+    uint32_t validMask;
+
+    /// Slots for each set, ways rounded up to fill whole host cache lines.
+    int stride;
+    /// Valid bits for each set. A power of two below 64 so a set never
+    /// straddles a word, whole words above.
+    int validStride;
 
     /// The storage for the tags. Cheating and using more bits than neeeded.
-    std::vector<uint64_t> tags;
+    std::vector<uint64_t> tagStorage;
+    /// tagStorage aligned to a host cache line
+    uint64_t *tags;
 
     /// The storage for the state. Cheating and using more bits that needed.
     std::vector<uint32_t> states;
 
+    /// One bit per line, set if the line is valid
+    std::vector<uint64_t> valid;
+
+    bool packed;
+    /// Line i is state then tag at bit i * (stateBits + tagBits).
+    std::vector<uint64_t> packedBits;
+
+    static MatchKernel matchKernel;
+    static const char* kernelName;
+
     /// Sum of the size of all tag arrays.
     static int64_t totalSize;
 };
@@ -0,0 +1,63 @@
+#include <cassert>
+
+#include "tag_index.hh"
+#include "util.hh"
+
+TagIndex::TagIndex(int64_t lines)
+{
+    assert(lines > 0);
+    int64_t slots = 2;
+    while (slots < lines * 2) {
+        slots *= 2;
+    }
+    table.resize(slots, {0, -1});
+    mask = slots - 1;
+}
+
+int64_t
+TagIndex::find(uint64_t line_address)
+{
+    uint64_t slot = hashIndex(line_address) & mask;
+    while (table[slot].line >= 0) {
+        if (table[slot].lineAddress == line_address) {
+            return table[slot].line;
+        }
+        slot = (slot + 1) & mask;
+    }
+    return -1;
+}
+
+void
+TagIndex::insert(uint64_t line_address, int64_t line)
+{
+    assert(line >= 0);
+    uint64_t slot = hashIndex(line_address) & mask;
+    while (table[slot].line >= 0) {
+        assert(table[slot].lineAddress != line_address);
+        slot = (slot + 1) & mask;
+    }
+    table[slot] = {line_address, line};
+}
+
+void
+TagIndex::erase(uint64_t line_address)
+{
+    uint64_t slot = hashIndex(line_address) & mask;
+    while (table[slot].line >= 0 && table[slot].lineAddress != line_address) {
+        slot = (slot + 1) & mask;
+    }
+    if (table[slot].line < 0) return;
+
+    // Shift the following entries back so no probe sequence is broken.
+    uint64_t hole = slot;
+    for (uint64_t next = (hole + 1) & mask; table[next].line >= 0;
+         next = (next + 1) & mask) {
+        uint64_t home = hashIndex(table[next].lineAddress) & mask;
+        // Move the entry if its home is not between the hole and it.
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            table[hole] = table[next];
+            hole = next;
+        }
+    }
+    table[hole].line = -1;
+}
@@ -0,0 +1,48 @@
+#ifndef CSIM_TAG_INDEX_H
+#define CSIM_TAG_INDEX_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * A hash table from line address to the line in the tag array that holds
+ * it. Lets a highly associative cache find a line without scanning the set.
+ *
+ * Open addressing with linear probing. The table is sized for the number of
+ * lines and never grows, it is at most half full.
+ */
+class TagIndex
+{
+  public:
+    /**
+     * @param lines in the cache
+     */
+    TagIndex(int64_t lines);
+
+    /**
+     * @return the line that holds line_address, or -1 if there is none
+     */
+    int64_t find(uint64_t line_address);
+
+    /**
+     * Record that line holds line_address. line_address must not be in the
+     * index already.
+     */
+    void insert(uint64_t line_address, int64_t line);
+
+    /**
+     * Remove line_address from the index if it is there.
+     */
+    void erase(uint64_t line_address);
+
+  private:
+    struct Entry {
+        uint64_t lineAddress;
+        int64_t line; // -1 if empty
+    };
+
+    std::vector<Entry> table;
+    uint64_t mask;
+};
+
+#endif // CSIM_TAG_INDEX_H
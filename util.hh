@@ -16,6 +16,35 @@ inline int log2int(uint64_t value)
     return __builtin_ctzll(value);
 }
 
+/**
+ * @return a mask of the low bits bits. Valid for 0 to 64 bits.
+ */
+inline uint64_t bitMask(int bits)
+{
+    assert(bits >= 0 && bits <= 64);
+    return bits == 64 ? ~(uint64_t)0 : ((uint64_t)1 << bits) - 1;
+}
+
+/**
+ * @return true if value can be represented with bits bits.
+ */
+inline bool fitsInBits(uint64_t value, int bits)
+{
+    return (value & ~bitMask(bits)) == 0;
+}
+
+/**
+ * Mixes all of the bits of value so that the low bits can be used to index
+ * a hash table.
+ */
+inline uint64_t hashIndex(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    return value;
+}
+
 #ifdef DEBUG
 #define DPRINT(args) \
     do {\
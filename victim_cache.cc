@@ -0,0 +1,51 @@
+#include <cassert>
+#include <cstring>
+
+#include "victim_cache.hh"
+
+VictimCache::VictimCache(int entries, int line_bits, int addr_bits) :
+    entries(entries), lineBits(line_bits),
+    // one set, the tag is the whole line address
+    tags(entries, 3, addr_bits - line_bits, entries, 1),
+    data(entries, 1 << line_bits),
+    lru(ReplacementPolicy::create(ReplacementPolicy::LRU, 1, entries))
+{
+    assert(entries > 0);
+}
+
+VictimCache::~VictimCache()
+{
+    delete lru;
+}
+
+int
+VictimCache::find(uint64_t address)
+{
+    return tags.findWay(0, address >> lineBits);
+}
+
+int
+VictimCache::getVictim()
+{
+    // Invalid entries are moved to the LRU end, so they go first.
+    return lru->getVictim(0);
+}
+
+void
+VictimCache::fill(int entry, uint64_t address, const uint8_t* line,
+                  bool dirty, bool prefetched)
+{
+    assert(entry >= 0 && entry < entries);
+    tags.setTag(entry, address >> lineBits);
+    tags.setState(entry, (dirty ? Dirty : Clean) |
+                         (prefetched ? Prefetched : 0));
+    memcpy(data.getLine(entry), line, 1 << lineBits);
+    lru->touch(0, entry);
+}
+
+void
+VictimCache::invalidate(int entry)
+{
+    tags.setState(entry, Invalid);
+    lru->invalidate(0, entry);
+}
@@ -0,0 +1,77 @@
+#ifndef CSIM_VICTIM_CACHE_H
+#define CSIM_VICTIM_CACHE_H
+
+#include <cstdint>
+
+#include "replacement.hh"
+#include "sram_array.hh"
+#include "tag_array.hh"
+
+/**
+ * A small fully associative buffer of lines evicted from a cache. The cache
+ * probes it on a miss and swaps the line back on a hit, so a few conflicting
+ * lines do not have to go to memory.
+ *
+ * This only stores lines. The cache decides what to do with the line it
+ * replaces.
+ */
+class VictimCache
+{
+  public:
+    /**
+     * @param entries number of lines
+     * @param line_bits log2 of the line size
+     * @param addr_bits of the processor
+     */
+    VictimCache(int entries, int line_bits, int addr_bits);
+
+    ~VictimCache();
+
+    /**
+     * @return the entry holding the line of address, or -1
+     */
+    int find(uint64_t address);
+
+    /**
+     * @return the entry to replace next, an invalid one if there is one
+     */
+    int getVictim();
+
+    bool isValid(int entry) { return tags.getState(entry) & 1; }
+    bool isDirty(int entry) {
+        return (tags.getState(entry) & Dirty) == Dirty;
+    }
+    /// @return true if the line was prefetched and not used yet
+    bool isPrefetched(int entry) { return tags.getState(entry) & Prefetched; }
+
+    /**
+     * @return the address of the line in entry
+     */
+    uint64_t getAddress(int entry) { return tags.getTag(entry) << lineBits; }
+
+    uint8_t* getLine(int entry) { return data.getLine(entry); }
+
+    /**
+     * Put the line of address in entry and make it the most recently used.
+     */
+    void fill(int entry, uint64_t address, const uint8_t* line, bool dirty,
+              bool prefetched = false);
+
+    void invalidate(int entry);
+
+  private:
+    enum State {
+        Invalid=0,
+        Clean=1,
+        Dirty=3,
+        Prefetched=4 // bit set with Clean or Dirty
+    };
+
+    int entries;
+    int lineBits;
+    TagArray tags;
+    SRAMArray data;
+    ReplacementPolicy *lru;
+};
+
+#endif // CSIM_VICTIM_CACHE_H
@@ -0,0 +1,62 @@
+#include <cassert>
+
+#include "util.hh"
+#include "way_predictor.hh"
+
+WayPredictor*
+WayPredictor::create(Type type, int64_t sets, int ways)
+{
+    switch (type) {
+      case MRU: return new MRUPredictor(sets, ways);
+      case Hashed: return new HashedPredictor(ways);
+    }
+    assert(0);
+    return nullptr;
+}
+
+WayPredictor::WayPredictor(int ways) :
+    ways(ways)
+{
+    assert(ways > 0);
+}
+
+WayPredictor::~WayPredictor()
+{
+
+}
+
+MRUPredictor::MRUPredictor(int64_t sets, int ways) :
+    WayPredictor(ways), lastWay(sets, 0)
+{
+    assert(sets > 0);
+}
+
+int
+MRUPredictor::predict(int64_t set, uint64_t line_address)
+{
+    return lastWay[set];
+}
+
+void
+MRUPredictor::update(int64_t set, uint64_t line_address, int way)
+{
+    lastWay[set] = way;
+}
+
+HashedPredictor::HashedPredictor(int ways) :
+    WayPredictor(ways), table(tableSize, 0)
+{
+
+}
+
+int
+HashedPredictor::predict(int64_t set, uint64_t line_address)
+{
+    return table[hashIndex(line_address) & (tableSize - 1)];
+}
+
+void
+HashedPredictor::update(int64_t set, uint64_t line_address, int way)
+{
+    table[hashIndex(line_address) & (tableSize - 1)] = way;
+}
@@ -0,0 +1,79 @@
+#ifndef CSIM_WAY_PREDICTOR_H
+#define CSIM_WAY_PREDICTOR_H
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * Guesses which way of a set holds a line before the tags are compared,
+ * so only that way's tag and data need to be read.
+ *
+ * The cache tells the predictor the way every hit and fill used. A wrong
+ * guess costs a second probe of the whole set.
+ */
+class WayPredictor
+{
+  public:
+    enum Type {
+        MRU,   // the way of the set used last
+        Hashed // a table indexed by a hash of the line address
+    };
+
+    /**
+     * @return a new predictor of type for a cache with sets sets of ways
+     *         ways. The caller owns it.
+     */
+    static WayPredictor* create(Type type, int64_t sets, int ways);
+
+    virtual ~WayPredictor();
+
+    /**
+     * @return the way of set that probably holds line_address
+     */
+    virtual int predict(int64_t set, uint64_t line_address) = 0;
+
+    /**
+     * The line line_address was hit or filled in way of set.
+     */
+    virtual void update(int64_t set, uint64_t line_address, int way) = 0;
+
+  protected:
+    WayPredictor(int ways);
+
+    int ways;
+};
+
+/**
+ * Predicts the most recently used way of each set.
+ */
+class MRUPredictor : public WayPredictor
+{
+  public:
+    MRUPredictor(int64_t sets, int ways);
+
+    int predict(int64_t set, uint64_t line_address) override;
+    void update(int64_t set, uint64_t line_address, int way) override;
+
+  private:
+    std::vector<int> lastWay;
+};
+
+/**
+ * Remembers the way of each line in a table indexed by a hash of its
+ * address, so lines of the same set that alternate are told apart.
+ */
+class HashedPredictor : public WayPredictor
+{
+  public:
+    HashedPredictor(int ways);
+
+    int predict(int64_t set, uint64_t line_address) override;
+    void update(int64_t set, uint64_t line_address, int way) override;
+
+  private:
+    static const int tableSize = 1024; // a power of two
+
+    std::vector<int> table;
+};
+
+#endif // CSIM_WAY_PREDICTOR_H
@@ -0,0 +1,63 @@
+#include <cassert>
+#include <cstring>
+
+#include "write_buffer.hh"
+
+WriteBuffer::WriteBuffer(int entries, int line_size, bool combining) :
+    writes(0), combined(0), maxEntries(entries), lineSize(line_size),
+    combining(combining)
+{
+    assert(entries > 0);
+}
+
+bool
+WriteBuffer::add(uint64_t address, int size, const uint8_t* data)
+{
+    uint64_t line_address = address & ~(uint64_t)(lineSize - 1);
+    int offset = address - line_address;
+    assert(offset + size <= lineSize);
+
+    int position = find(line_address);
+    if (position >= 0 && !combining) return false;
+    if (position < 0) {
+        if (isFull()) return false;
+        entries.push_back({line_address, std::vector<uint8_t>(lineSize),
+                           std::vector<bool>(lineSize, false), 0});
+        position = entries.size() - 1;
+    } else {
+        combined++;
+    }
+    writes++;
+
+    Entry &entry = entries[position];
+    memcpy(&entry.data[offset], data, size);
+    for (int i = offset; i < offset + size; i++) {
+        if (!entry.valid[i]) {
+            entry.valid[i] = true;
+            entry.validBytes++;
+        }
+    }
+    return true;
+}
+
+int
+WriteBuffer::find(uint64_t line_address)
+{
+    for (int i = 0; i < (int)entries.size(); i++) {
+        if (entries[i].lineAddress == line_address) return i;
+    }
+    return -1;
+}
+
+bool
+WriteBuffer::merge(uint64_t line_address, uint8_t* line)
+{
+    int position = find(line_address);
+    if (position < 0) return false;
+
+    Entry &entry = entries[position];
+    for (int i = 0; i < lineSize; i++) {
+        if (entry.valid[i]) line[i] = entry.data[i];
+    }
+    return true;
+}
@@ -0,0 +1,70 @@
+#ifndef CSIM_WRITE_BUFFER_H
+#define CSIM_WRITE_BUFFER_H
+
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+/**
+ * Writes waiting to go to the level below a cache that does not keep them,
+ * oldest first.
+ *
+ * There is at most one entry per line. A plain buffer makes a second write
+ * to a line wait until the first has gone, so memory never sees writes to a
+ * line out of order. A combining buffer merges it into the entry instead,
+ * and keeps partial lines around so more stores can fill them.
+ */
+class WriteBuffer
+{
+  public:
+    struct Entry {
+        uint64_t lineAddress;
+        std::vector<uint8_t> data;
+        std::vector<bool> valid; // per byte of data
+        int validBytes;
+    };
+
+    /**
+     * @param entries the number of lines the buffer holds
+     * @param line_size in bytes
+     * @param combining to merge writes to the same line
+     */
+    WriteBuffer(int entries, int line_size, bool combining);
+
+    /**
+     * Add a write of size bytes at address.
+     * @return false if it has to wait for an entry to be sent
+     */
+    bool add(uint64_t address, int size, const uint8_t* data);
+
+    /**
+     * @return the position of the entry for the line, or -1
+     */
+    int find(uint64_t line_address);
+
+    /**
+     * Copy the bytes written to the line at line_address over line.
+     * @return true if the buffer had any
+     */
+    bool merge(uint64_t line_address, uint8_t* line);
+
+    Entry& get(int position) { return entries[position]; }
+    void remove(int position) { entries.erase(entries.begin() + position); }
+    int getSize() { return entries.size(); }
+    bool isEmpty() { return entries.empty(); }
+    bool isFull() { return (int)entries.size() == maxEntries; }
+    bool isCombining() { return combining; }
+    bool isComplete(const Entry &entry) { return entry.validBytes == lineSize; }
+
+    /// Writes added, and how many of them were merged into an entry
+    int64_t writes;
+    int64_t combined;
+
+  private:
+    int maxEntries;
+    int lineSize;
+    bool combining;
+    std::deque<Entry> entries;
+};
+
+#endif // CSIM_WRITE_BUFFER_H
@@ -0,0 +1,74 @@
+#include <cassert>
+#include <cstring>
+
+#include "writeback_buffer.hh"
+
+WritebackBuffer::WritebackBuffer(int entries, int line_size) :
+    parked(0), drained(0), hits(0), maxOccupancy(0),
+    maxEntries(entries), lineSize(line_size),
+    busyTick(-1), drainScheduled(false), waitingForRetry(false)
+{
+    assert(entries > 0);
+}
+
+void
+WritebackBuffer::park(uint64_t address, const uint8_t* data)
+{
+    assert(!isFull());
+    assert(find(address) < 0);
+    entries.push_back({address, std::vector<uint8_t>(data, data + lineSize)});
+    parked++;
+    if (getSize() > maxOccupancy) maxOccupancy = getSize();
+    scheduleDrain();
+}
+
+int
+WritebackBuffer::find(uint64_t address)
+{
+    for (int i = 0; i < getSize(); i++) {
+        if (entries[i].address == address) return i;
+    }
+    return -1;
+}
+
+void
+WritebackBuffer::retry()
+{
+    waitingForRetry = false;
+    scheduleDrain();
+}
+
+void
+WritebackBuffer::scheduleDrain()
+{
+    if (drainScheduled || waitingForRetry || entries.empty()) return;
+    drainScheduled = true;
+    schedule(1, [this]{drain();});
+}
+
+void
+WritebackBuffer::drain()
+{
+    drainScheduled = false;
+    if (waitingForRetry || entries.empty()) return;
+
+    if (busyTick == curTick()) {
+        // The cache used the port this tick, try the next one.
+        scheduleDrain();
+        return;
+    }
+
+    // Take the entry out before it is sent, sending can call back into the
+    // cache.
+    Entry entry = std::move(entries.front());
+    entries.pop_front();
+    if (!send(entry.address, entry.data.data())) {
+        entries.push_front(std::move(entry));
+        waitingForRetry = true;
+        return;
+    }
+    busyTick = curTick();
+    drained++;
+    freed();
+    scheduleDrain();
+}
@@ -0,0 +1,97 @@
+#ifndef CSIM_WRITEBACK_BUFFER_H
+#define CSIM_WRITEBACK_BUFFER_H
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "ticked_object.hh"
+
+/**
+ * Dirty lines evicted from a cache, waiting to be written back.
+ *
+ * Evictions park here instead of going down while a fill is being handled,
+ * and drain one per tick, oldest first, on the ticks the cache does not
+ * use its port to the level below. A parked line is still part of the
+ * cache: a request for it takes it back out.
+ */
+class WritebackBuffer : public TickedObject
+{
+  public:
+    /**
+     * @param entries the number of lines the buffer holds
+     * @param line_size in bytes
+     */
+    WritebackBuffer(int entries, int line_size);
+
+    /**
+     * Called to write a line back. Returns false if the level below is
+     * full, then nothing is sent until retry is called.
+     */
+    void setSend(const std::function<bool(uint64_t, const uint8_t*)>& send) {
+        this->send = send;
+    }
+
+    /**
+     * Called every time an entry is freed.
+     */
+    void setFreed(const std::function<void(void)>& freed) {
+        this->freed = freed;
+    }
+
+    /**
+     * Park the dirty line at address. The buffer must not be full.
+     */
+    void park(uint64_t address, const uint8_t* data);
+
+    /**
+     * @return the entry holding the line at address, or -1
+     */
+    int find(uint64_t address);
+
+    uint8_t* getLine(int entry) { return entries[entry].data.data(); }
+
+    void remove(int entry) { entries.erase(entries.begin() + entry); }
+
+    /**
+     * The cache sent a request below this tick, so the port is not idle.
+     */
+    void portBusy() { busyTick = curTick(); }
+
+    /**
+     * The level below has space again.
+     */
+    void retry();
+
+    int getSize() { return entries.size(); }
+    int getEntries() { return maxEntries; }
+    bool isFull() { return getSize() == maxEntries; }
+
+    int64_t parked;
+    int64_t drained;
+    int64_t hits; // requests that took a line back out
+    int maxOccupancy;
+
+  private:
+    struct Entry {
+        uint64_t address;
+        std::vector<uint8_t> data;
+    };
+
+    void scheduleDrain();
+    void drain();
+
+    int maxEntries;
+    int lineSize;
+    std::deque<Entry> entries;
+    std::function<bool(uint64_t, const uint8_t*)> send;
+    std::function<void(void)> freed;
+
+    /// Last tick the port to the level below was used
+    int64_t busyTick;
+    bool drainScheduled;
+    bool waitingForRetry;
+};
+
+#endif // CSIM_WRITEBACK_BUFFER_H